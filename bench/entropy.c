@@ -0,0 +1,137 @@
+/*
+ * Microbenchmark for shannon_entropy(), comparing it against the previous
+ * implementation: a strlen() pass, a single histogram and the branch-tree
+ * log2. Both are checked to agree before anything is timed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log2_lshift16.h"
+#include "log2_lshift16_tree.h"
+
+extern double shannon_entropy(const uint8_t *s);
+
+#define BUCKET_SIZE (1 << 8)
+
+static double shannon_entropy_ref(const uint8_t *s)
+{
+    const uint64_t count = strlen((char *) s);
+    uint64_t entropy_sum = 0;
+    const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
+
+    uint32_t bucket[256];
+    memset(&bucket, 0, sizeof(bucket));
+
+    for (uint32_t i = 0; i < count; i++)
+        bucket[s[i]]++;
+
+    for (uint32_t i = 0; i < BUCKET_SIZE; i++) {
+        if (bucket[i]) {
+            uint64_t p = bucket[i];
+            p *= LOG2_ARG_SHIFT / count;
+            entropy_sum += -p * log2_lshift16_tree(p);
+        }
+    }
+
+    entropy_sum /= LOG2_ARG_SHIFT;
+    return entropy_sum * 100.0 / entropy_max;
+}
+
+#define MAX_LEN 4096
+#define NSTRINGS 64
+
+static uint8_t pool[NSTRINGS][MAX_LEN + 32];
+
+static void fill(const char *charset, size_t len)
+{
+    size_t n = strlen(charset);
+    for (int i = 0; i < NSTRINGS; i++) {
+        /* Vary the alignment as the allocator would */
+        uint8_t *s = pool[i] + (i & 15);
+        for (size_t j = 0; j < len; j++)
+            s[j] = charset[rand() % n];
+        s[len] = '\0';
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Average time of one call of @f in nanoseconds */
+static double measure(double (*f)(const uint8_t *), size_t len)
+{
+    const int rounds = 1 + (1 << 22) / (NSTRINGS * (len + 16));
+    volatile double sink = 0;
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < NSTRINGS; i++)
+            sink += f(pool[i] + (i & 15));
+    }
+    (void) sink;
+    return (now() - start) / ((double) rounds * NSTRINGS);
+}
+
+static int verify(void)
+{
+    for (uint64_t x = 0; x <= 2 * LOG2_ARG_SHIFT; x++) {
+        if (log2_lshift16(x) != log2_lshift16_tree(x)) {
+            printf("log2_lshift16(%lu) = %d, expected %d\n", (unsigned long) x,
+                   log2_lshift16(x), log2_lshift16_tree(x));
+            return -1;
+        }
+    }
+
+    char charset[256];
+    for (int c = 1; c < 256; c++)
+        charset[c - 1] = c;
+    charset[255] = '\0';
+    for (size_t len = 0; len <= 300; len++) {
+        fill(len & 1 ? charset : "abc", len);
+        for (int i = 0; i < NSTRINGS; i++) {
+            const uint8_t *s = pool[i] + (i & 15);
+            if (shannon_entropy(s) != shannon_entropy_ref(s)) {
+                printf("entropy differs for a string of length %zu\n", len);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name, *charset;
+    } sets[] = {
+        {"lower", "abcdefghijklmnopqrstuvwxyz"},
+        {"same", "a"},
+        {"binary",
+         "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10"
+         "\x80\x90\xa0\xb0\xc0\xd0\xe0\xf0\xff\xfe\xfd\xfc\xfb\xfa\xf9\xf8"},
+    };
+    static const size_t lens[] = {8, 32, 128, 1024, MAX_LEN};
+
+    if (verify())
+        return EXIT_FAILURE;
+
+    printf("%-8s %6s %12s %12s %8s\n", "charset", "length", "old (ns)",
+           "new (ns)", "speedup");
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        for (size_t j = 0; j < sizeof(lens) / sizeof(lens[0]); j++) {
+            fill(sets[i].charset, lens[j]);
+            double old = measure(shannon_entropy_ref, lens[j]);
+            double cur = measure(shannon_entropy, lens[j]);
+            printf("%-8s %6zu %12.1f %12.1f %7.2fx\n", sets[i].name, lens[j],
+                   old, cur, old / cur);
+        }
+    }
+    return EXIT_SUCCESS;
+}
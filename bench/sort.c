@@ -0,0 +1,175 @@
+/*
+ * Microbenchmark for q_sort(), comparing the list merge sort against the same
+ * merge sort without galloping, the array-assisted sort enabled by
+ * q_set_sort_buffer() and the radix sort enabled by q_sort_radix. All must
+ * leave the nodes in the same order.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+
+/* Normally provided by the console */
+int web_connfd = 0;
+
+#define ROUNDS 3
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Random lowercase strings of 5 to 10 characters, as "ih RAND" inserts */
+static void fill_random(char *buf)
+{
+    int len = 5 + rand() % 6;
+    for (int i = 0; i < len; i++)
+        buf[i] = 'a' + rand() % 26;
+    buf[len] = '\0';
+}
+
+/* Strings sharing a prefix longer than the cached key */
+static void fill_prefixed(char *buf)
+{
+    sprintf(buf, "common_prefix_%06d", rand() % 1000000);
+}
+
+/* Ascending blocks of 1000 strings at random offsets, longer than the cached
+ * key so that every comparison reads the strings. Merges of such runs move
+ * whole blocks at once.
+ */
+static void fill_blocks(char *buf)
+{
+    static int base, i;
+    int k = i++ % 1000;
+    if (!k)
+        base = rand() % 1000000;
+    sprintf(buf, "common_prefix_%07d", base + k);
+}
+
+/* Few distinct values, to stress stability */
+static void fill_duplicates(char *buf)
+{
+    sprintf(buf, "dup%d", rand() % 16);
+}
+
+/* Whether the queue holds the nodes in the order recorded in @sorted */
+static bool same_order(struct list_head *head, struct list_head **sorted)
+{
+    size_t i = 0;
+    struct list_head *node;
+    list_for_each (node, head) {
+        if (node != sorted[i++])
+            return false;
+    }
+    return true;
+}
+
+/* Put the nodes back in the order recorded in @nodes */
+static void relink(struct list_head *head, struct list_head **nodes, size_t n)
+{
+    INIT_LIST_HEAD(head);
+    for (size_t i = 0; i < n; i++)
+        list_add_tail(nodes[i], head);
+}
+
+/* Sort the queue from its original order ROUNDS times, return the best time */
+static double measure(struct list_head *head,
+                      struct list_head **nodes,
+                      size_t n)
+{
+    double best = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        relink(head, nodes, n);
+        double start = now();
+        q_sort(head, false);
+        double t = now() - start;
+        if (!r || t < best)
+            best = t;
+    }
+    return best;
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        void (*fill)(char *buf);
+    } sets[] = {
+        {"random", fill_random},
+        {"prefixed", fill_prefixed},
+        {"dups", fill_duplicates},
+        {"blocks", fill_blocks},
+    };
+    static const size_t sizes[] = {1000, 100000, 1000000};
+
+    printf("%-9s %8s %10s %10s %10s %10s\n", "strings", "length",
+           "list (ms)", "plain (ms)", "array (ms)", "radix (ms)");
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+        for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+            size_t n = sizes[z];
+            struct list_head *head = q_new();
+            struct list_head **nodes = malloc(n * sizeof(*nodes));
+            struct list_head **sorted = malloc(n * sizeof(*sorted));
+            q_sort_slot_t *buf = malloc(2 * n * sizeof(*buf));
+            if (!head || !nodes || !sorted || !buf)
+                return EXIT_FAILURE;
+
+            srand(s * 31 + z);
+            for (size_t i = 0; i < n; i++) {
+                char str[32];
+                sets[s].fill(str);
+                if (!q_insert_tail(head, str))
+                    return EXIT_FAILURE;
+            }
+            size_t i = 0;
+            struct list_head *node;
+            list_for_each (node, head)
+                nodes[i++] = node;
+
+            q_set_sort_buffer(NULL, 0);
+            double list = measure(head, nodes, n);
+            i = 0;
+            list_for_each (node, head)
+                sorted[i++] = node;
+
+            q_sort_gallop = 0;
+            double plain = measure(head, nodes, n);
+            bool ok = same_order(head, sorted);
+            q_sort_gallop = 1;
+
+            q_set_sort_buffer(buf, 2 * n);
+            double array = measure(head, nodes, n);
+            ok = ok && same_order(head, sorted);
+            q_set_sort_buffer(NULL, 0);
+
+            q_sort_radix = 1;
+            double radix = measure(head, nodes, n);
+            ok = ok && same_order(head, sorted);
+            q_sort_radix = 0;
+
+            if (!ok) {
+                printf("%s: sorts disagree on %zu strings\n", sets[s].name, n);
+                return EXIT_FAILURE;
+            }
+            printf("%-9s %8zu %10.3f %10.3f %10.3f %10.3f\n", sets[s].name, n,
+                   list * 1e3, plain * 1e3, array * 1e3, radix * 1e3);
+
+            q_set_sort_buffer(NULL, 0);
+            q_free(head);
+            free(nodes);
+            free(sorted);
+            free(buf);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -56,6 +56,9 @@ bool get_int(char *vname, int *loc);
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Execute a command that has already been split into arguments */
+bool interpret_cmda(int argc, char *argv[]);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
@@ -0,0 +1,334 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cqueue.h"
+#include "report.h"
+
+/* Hazard pointers
+ *
+ * Before dereferencing an element it got from the queue, a thread publishes
+ * its address in one of its hazard pointers and checks that the element is
+ * still reachable. An element taken off the queue is retired to a list local
+ * to the thread, and is only freed once no hazard pointer holds it.
+ */
+#define CQ_MAX_THREADS 256
+#define CQ_HAZARDS 2
+
+/* Retired elements are checked against the hazard pointers in batches. With
+ * more of them than there can be hazard pointers, every scan frees at least
+ * half of the batch.
+ */
+#define CQ_RETIRE_MAX (2 * CQ_MAX_THREADS * CQ_HAZARDS)
+
+typedef struct {
+    atomic_bool used;
+    _Atomic(cq_element_t *) hp[CQ_HAZARDS];
+} __attribute__((aligned(64))) hazard_rec_t;
+
+static hazard_rec_t hazards[CQ_MAX_THREADS];
+static atomic_int hazards_in_use; /* Records ever handed out, to bound scans */
+
+static _Thread_local hazard_rec_t *my_hazards = NULL;
+static _Thread_local cq_element_t *retired[CQ_RETIRE_MAX];
+static _Thread_local int nretired = 0;
+
+/* Elements still hazardous when the thread that retired them exited, linked
+ * through their next field.
+ */
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+static cq_element_t *orphans = NULL;
+
+static hazard_rec_t *hazard_rec(void)
+{
+    if (my_hazards)
+        return my_hazards;
+
+    for (int i = 0; i < CQ_MAX_THREADS; i++) {
+        bool unused = false;
+        if (atomic_load(&hazards[i].used) ||
+            !atomic_compare_exchange_strong(&hazards[i].used, &unused, true))
+            continue;
+
+        int n = atomic_load(&hazards_in_use);
+        while (n <= i &&
+               !atomic_compare_exchange_weak(&hazards_in_use, &n, i + 1))
+            ;
+        my_hazards = &hazards[i];
+        return my_hazards;
+    }
+
+    report_event(MSG_FATAL, "More than %d threads use concurrent queues",
+                 CQ_MAX_THREADS);
+    return NULL;
+}
+
+/* Read @src and keep the element read safe from being freed */
+static cq_element_t *protect(int slot, _Atomic(cq_element_t *) *src)
+{
+    hazard_rec_t *rec = hazard_rec();
+    cq_element_t *e = atomic_load(src);
+    for (;;) {
+        atomic_store(&rec->hp[slot], e);
+        cq_element_t *again = atomic_load(src);
+        if (again == e)
+            return e;
+        e = again;
+    }
+}
+
+static void unprotect(void)
+{
+    hazard_rec_t *rec = hazard_rec();
+    for (int i = 0; i < CQ_HAZARDS; i++)
+        atomic_store(&rec->hp[i], NULL);
+}
+
+static bool is_hazard(const cq_element_t *e)
+{
+    int n = atomic_load(&hazards_in_use);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < CQ_HAZARDS; j++) {
+            if (atomic_load(&hazards[i].hp[j]) == e)
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Free the retired elements no thread is reading anymore */
+static void reclaim(void)
+{
+    int kept = 0;
+    for (int i = 0; i < nretired; i++) {
+        if (is_hazard(retired[i]))
+            retired[kept++] = retired[i];
+        else
+            free(retired[i]);
+    }
+    nretired = kept;
+}
+
+static void retire(cq_element_t *e)
+{
+    retired[nretired++] = e;
+    if (nretired == CQ_RETIRE_MAX)
+        reclaim();
+}
+
+/* Free the orphans no thread is reading anymore */
+static void reclaim_orphans(void)
+{
+    pthread_mutex_lock(&orphan_lock);
+    cq_element_t **pp = &orphans;
+    while (*pp) {
+        cq_element_t *e = *pp;
+        if (is_hazard(e)) {
+            pp = (cq_element_t **) &e->next;
+            continue;
+        }
+        *pp = atomic_load(&e->next);
+        free(e);
+    }
+    pthread_mutex_unlock(&orphan_lock);
+}
+
+void cq_thread_exit(void)
+{
+    if (!my_hazards)
+        return;
+
+    unprotect();
+    reclaim();
+    if (nretired) {
+        pthread_mutex_lock(&orphan_lock);
+        for (int i = 0; i < nretired; i++) {
+            atomic_store(&retired[i]->next, orphans);
+            orphans = retired[i];
+        }
+        pthread_mutex_unlock(&orphan_lock);
+        nretired = 0;
+    }
+
+    atomic_store(&my_hazards->used, false);
+    my_hazards = NULL;
+}
+
+static cq_element_t *cq_new_element(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    cq_element_t *e = malloc(sizeof(cq_element_t) + len);
+    if (!e)
+        return NULL;
+
+    atomic_init(&e->next, NULL);
+    memcpy(e->data, s, len);
+    return e;
+}
+
+/* Create an empty concurrent queue */
+cqueue_t *cq_new(cq_mode_t mode)
+{
+    cqueue_t *q = malloc(sizeof(cqueue_t));
+    if (!q)
+        return NULL;
+
+    cq_element_t *sentinel = cq_new_element("");
+    if (!sentinel) {
+        free(q);
+        return NULL;
+    }
+    atomic_init(&q->head, sentinel);
+    atomic_init(&q->tail, sentinel);
+    q->mode = mode;
+    pthread_mutex_init(&q->head_lock, NULL);
+    pthread_mutex_init(&q->tail_lock, NULL);
+    return q;
+}
+
+/* Free all storage used by queue */
+void cq_free(cqueue_t *q)
+{
+    if (!q)
+        return;
+
+    cq_element_t *e = atomic_load(&q->head);
+    while (e) {
+        cq_element_t *next = atomic_load(&e->next);
+        free(e);
+        e = next;
+    }
+    pthread_mutex_destroy(&q->head_lock);
+    pthread_mutex_destroy(&q->tail_lock);
+    free(q);
+
+    reclaim();
+    reclaim_orphans();
+}
+
+static void lock_free_insert_tail(cqueue_t *q, cq_element_t *e)
+{
+    for (;;) {
+        cq_element_t *tail = protect(0, &q->tail);
+        cq_element_t *next = atomic_load(&tail->next);
+        if (tail != atomic_load(&q->tail))
+            continue;
+
+        /* Help a producer which linked its element but did not move tail */
+        if (next) {
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+
+        cq_element_t *expected = NULL;
+        if (atomic_compare_exchange_strong(&tail->next, &expected, e)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, e);
+            break;
+        }
+    }
+    unprotect();
+}
+
+/* Only producers touch the tail, so with two locks a consumer may run at the
+ * same time. It reads the next pointer written here, hence the atomic store.
+ */
+static void locked_insert_tail(cqueue_t *q, cq_element_t *e)
+{
+    pthread_mutex_t *lock =
+        q->mode == CQ_TWO_LOCK ? &q->tail_lock : &q->head_lock;
+    pthread_mutex_lock(lock);
+    cq_element_t *tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&tail->next, e, memory_order_release);
+    atomic_store_explicit(&q->tail, e, memory_order_relaxed);
+    pthread_mutex_unlock(lock);
+}
+
+/* Insert an element at tail of queue */
+bool cq_insert_tail(cqueue_t *q, const char *s)
+{
+    if (!q || !s)
+        return false;
+
+    cq_element_t *e = cq_new_element(s);
+    if (!e)
+        return false;
+
+    if (q->mode == CQ_LOCK_FREE)
+        lock_free_insert_tail(q, e);
+    else
+        locked_insert_tail(q, e);
+    return true;
+}
+
+static void copy_data(const cq_element_t *e, char *sp, size_t bufsize)
+{
+    if (sp && bufsize) {
+        strncpy(sp, e->data, bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+}
+
+static bool lock_free_remove_head(cqueue_t *q, char *sp, size_t bufsize)
+{
+    cq_element_t *head;
+    for (;;) {
+        head = protect(0, &q->head);
+        cq_element_t *tail = atomic_load(&q->tail);
+        cq_element_t *next = protect(1, &head->next);
+        if (head != atomic_load(&q->head))
+            continue;
+
+        if (!next) {
+            unprotect();
+            return false;
+        }
+
+        /* Never let head pass tail */
+        if (head == tail) {
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+
+        /* The successor becomes the sentinel, its string is still valid */
+        copy_data(next, sp, bufsize);
+        if (atomic_compare_exchange_strong(&q->head, &head, next))
+            break;
+    }
+    unprotect();
+    retire(head);
+    return true;
+}
+
+/* The old sentinel can be freed at once: producers only write to the last
+ * element, and the one which linked its successor is done with it.
+ */
+static bool locked_remove_head(cqueue_t *q, char *sp, size_t bufsize)
+{
+    pthread_mutex_lock(&q->head_lock);
+    cq_element_t *head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    cq_element_t *next =
+        atomic_load_explicit(&head->next, memory_order_acquire);
+    if (!next) {
+        pthread_mutex_unlock(&q->head_lock);
+        return false;
+    }
+    copy_data(next, sp, bufsize);
+    atomic_store_explicit(&q->head, next, memory_order_relaxed);
+    pthread_mutex_unlock(&q->head_lock);
+
+    free(head);
+    return true;
+}
+
+/* Remove an element from head of queue */
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q)
+        return false;
+
+    if (q->mode == CQ_LOCK_FREE)
+        return lock_free_remove_head(q, sp, bufsize);
+    return locked_remove_head(q, sp, bufsize);
+}
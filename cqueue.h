@@ -0,0 +1,113 @@
+#ifndef LAB0_CQUEUE_H
+#define LAB0_CQUEUE_H
+
+/* This program implements a FIFO queue which may be used by several threads
+ * at once, e.g. as a work queue between producers and consumers.
+ *
+ * It is a singly-linked list that always starts with a sentinel, where
+ * producers append at the tail and consumers advance the head. Three ways of
+ * synchronizing them are available, see cq_mode_t.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "harness.h"
+
+/**
+ * cq_element_t - Concurrent queue element
+ * @next: the element behind this one, NULL at the tail
+ * @data: the string, which lives in the same block
+ */
+typedef struct cq_element {
+    _Atomic(struct cq_element *) next;
+    char data[];
+} cq_element_t;
+
+/**
+ * cq_mode_t - How threads using a concurrent queue are synchronized
+ * @CQ_LOCK_FREE: the lock-free queue of Michael and Scott. Head and tail are
+ *                advanced with compare-and-swap, and nodes taken off the queue
+ *                are reclaimed through hazard pointers, so a node is never
+ *                freed while another thread may still read it.
+ * @CQ_TWO_LOCK: the two-lock queue of Michael and Scott. Producers serialize
+ *               on a tail lock and consumers on a head lock; thanks to the
+ *               sentinel one of each may proceed in parallel.
+ * @CQ_ONE_LOCK: a single mutex for all operations, as a baseline
+ */
+typedef enum {
+    CQ_LOCK_FREE,
+    CQ_TWO_LOCK,
+    CQ_ONE_LOCK,
+} cq_mode_t;
+
+/**
+ * cqueue_t - Concurrent queue
+ * @head: the sentinel, whose successor is the first element
+ * @tail: the last element, or occasionally the one before it when lock-free
+ * @mode: synchronization used by the queue
+ * @head_lock: held while removing, and while inserting with CQ_ONE_LOCK
+ * @tail_lock: held while inserting with CQ_TWO_LOCK
+ */
+typedef struct {
+    _Atomic(cq_element_t *) head;
+    _Atomic(cq_element_t *) tail;
+    cq_mode_t mode;
+    pthread_mutex_t head_lock;
+    pthread_mutex_t tail_lock;
+} cqueue_t;
+
+/* Operations on concurrent queue */
+
+/**
+ * cq_new() - Create an empty concurrent queue
+ * @mode: synchronization used by the queue
+ *
+ * Return: NULL for allocation failed
+ */
+cqueue_t *cq_new(cq_mode_t mode);
+
+/**
+ * cq_free() - Free all storage used by queue, no effect if @q is NULL
+ * @q: queue to be freed
+ *
+ * No other thread may be using the queue any longer.
+ */
+void cq_free(cqueue_t *q);
+
+/**
+ * cq_insert_tail() - Insert an element at the tail, safe against other threads
+ * @q: queue
+ * @s: string would be inserted
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool cq_insert_tail(cqueue_t *q, const char *s);
+
+/**
+ * cq_remove_head() - Remove the element from head, safe against other threads
+ * @q: queue
+ * @sp: output buffer where the removed string is copied
+ * @bufsize: size of the string
+ *
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * The element itself is released once no thread may be reading it, which
+ * with a lock is right away.
+ *
+ * Return: true if an element was removed, false if queue is NULL or empty
+ */
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * cq_thread_exit() - Give up the hazard pointers of the calling thread
+ *
+ * To be called by every thread which used a lock-free queue before it
+ * exits. Elements it removed that are still being read by others are left
+ * for later reclamation.
+ */
+void cq_thread_exit(void);
+
+#endif /* LAB0_CQUEUE_H */
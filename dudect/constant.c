@@ -8,18 +8,13 @@
 #include "random.h"
 
 /* Maintain a queue independent from the qtest since
- * we do not want the test to affect the original functionality
+ * we do not want the test to affect the original functionality.
+ * Each thread measuring has its own queue and strings.
  */
-static struct list_head *l = NULL;
+static _Thread_local struct list_head *l = NULL;
 
 #define dut_new() ((void) (l = q_new()))
 
-#define dut_size(n)                                \
-    do {                                           \
-        for (int __iter = 0; __iter < n; ++__iter) \
-            q_size(l);                             \
-    } while (0)
-
 #define dut_insert_head(s, n)    \
     do {                         \
         int j = n;               \
@@ -27,17 +22,73 @@ static struct list_head *l = NULL;
             q_insert_head(l, s); \
     } while (0)
 
-#define dut_insert_tail(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_tail(l, s); \
-    } while (0)
-
 #define dut_free() ((void) (q_free(l)))
 
-static char random_string[N_MEASURES][8];
-static int random_string_iter = 0;
+static _Thread_local char random_string[N_MEASURES][8];
+static _Thread_local int random_string_iter = 0;
+
+/* Element taken off the queue by the operation timed, released after it */
+static _Thread_local element_t *removed = NULL;
+
+/* Linear operations are timed on queues of LINEAR_MIN_SIZE << k elements,
+ * for k picked at random below LINEAR_STEPS, so that their sizes are spread
+ * evenly on a log scale.
+ */
+#define LINEAR_MIN_SIZE 16
+#define LINEAR_STEPS 10
+
+/* The operations of DUT_FUNCS, each timed on queue l */
+static void dut_run_insert_head(char *s)
+{
+    q_insert_head(l, s);
+}
+
+static void dut_run_insert_tail(char *s)
+{
+    q_insert_tail(l, s);
+}
+
+static void dut_run_remove_head(char *s)
+{
+    removed = q_remove_head(l, NULL, 0);
+}
+
+static void dut_run_remove_tail(char *s)
+{
+    removed = q_remove_tail(l, NULL, 0);
+}
+
+static void dut_run_size(char *s)
+{
+    q_size(l);
+}
+
+static void dut_run_delete_mid(char *s)
+{
+    q_delete_mid(l);
+}
+
+static void dut_run_reverse(char *s)
+{
+    q_reverse(l);
+}
+
+static void dut_run_swap(char *s)
+{
+    q_swap(l);
+}
+
+static const struct {
+    void (*run)(char *s);
+    int scaling;
+    int min_size;
+    int change;
+} dut_ops[] = {
+#define _(x, scaling, min_size, change) \
+    [DUT(x)] = {dut_run_##x, scaling, min_size, change},
+    DUT_FUNCS
+#undef _
+};
 
 /* Implement the necessary queue interface to simulation */
 void init_dut(void)
@@ -67,96 +118,38 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
     }
 }
 
+int dut_length(int mode, const uint8_t *input)
+{
+    uint16_t x = *(const uint16_t *) input;
+    if (dut_ops[mode].scaling == DUT_LINEAR)
+        return dut_ops[mode].min_size + (LINEAR_MIN_SIZE << x % LINEAR_STEPS);
+    return dut_ops[mode].min_size + x % 10000;
+}
+
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
              int mode)
 {
-    assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
-
-    switch (mode) {
-    case DUT(insert_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(insert_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(remove_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    case DUT(remove_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    default:
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
+    assert(mode >= 0 && mode < (int) (sizeof(dut_ops) / sizeof(dut_ops[0])));
+
+    for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+        char *s = get_random_string();
+        dut_new();
+        dut_insert_head(get_random_string(),
+                        dut_length(mode, input_data + i * CHUNK_SIZE));
+        int before_size = q_size(l);
+        before_ticks[i] = cpucycles();
+        dut_ops[mode].run(s);
+        after_ticks[i] = cpucycles();
+        int after_size = q_size(l);
+        if (removed) {
+            q_release_element(removed);
+            removed = NULL;
         }
+        dut_free();
+        if (after_size - before_size != dut_ops[mode].change)
+            return false;
     }
     return true;
 }
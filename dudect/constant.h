@@ -12,22 +12,44 @@
 
 #define DROP_SIZE 20
 
-#define DUT_FUNCS  \
-    _(insert_head) \
-    _(insert_tail) \
-    _(remove_head) \
-    _(remove_tail)
+/* How the time an operation takes should depend on the length of the queue.
+ * Constant-time operations are tested for timing leakage, while for linear
+ * ones the scaling curve is fitted and reported.
+ */
+enum {
+    DUT_CONSTANT,
+    DUT_LINEAR,
+};
+
+/* Operations timed in simulation mode, as _(op, scaling, min_size, change):
+ * the queue holds at least @min_size elements when dut_run_<op>() in
+ * constant.c is timed, and its length must change by @change. Adding a line
+ * here and the function there is all it takes to time another operation.
+ */
+#define DUT_FUNCS                       \
+    _(insert_head, DUT_CONSTANT, 0, 1)  \
+    _(insert_tail, DUT_CONSTANT, 0, 1)  \
+    _(remove_head, DUT_CONSTANT, 1, -1) \
+    _(remove_tail, DUT_CONSTANT, 1, -1) \
+    _(size, DUT_LINEAR, 0, 0)           \
+    _(delete_mid, DUT_LINEAR, 1, -1)    \
+    _(reverse, DUT_LINEAR, 0, 0)        \
+    _(swap, DUT_LINEAR, 0, 0)
 
 #define DUT(x) DUT_##x
 
 enum {
-#define _(x) DUT(x),
+#define _(x, scaling, min_size, change) DUT(x),
     DUT_FUNCS
 #undef _
 };
 
 void init_dut();
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
+
+/* Length of the queue operation @mode is timed on, for the given input */
+int dut_length(int mode, const uint8_t *input);
+
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
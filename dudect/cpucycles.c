@@ -0,0 +1,181 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "cpucycles.h"
+
+#define CALIBRATE_ROUNDS 10000
+
+int cpucycles_backend = CPUCYCLES_SERIAL;
+_Thread_local int64_t cpucycles_overhead = 0;
+
+#if defined(CLOCK_MONOTONIC_RAW)
+#define CPUCYCLES_CLOCK_ID CLOCK_MONOTONIC_RAW
+#else
+#define CPUCYCLES_CLOCK_ID CLOCK_MONOTONIC
+#endif
+
+int64_t cpucycles_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CPUCYCLES_CLOCK_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__linux__)
+static _Thread_local int perf_fd = -1;
+static _Thread_local struct perf_event_mmap_page *perf_page = NULL;
+
+static bool perf_open(void)
+{
+    if (perf_page)
+        return true;
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0)
+        return false;
+
+    void *page =
+        mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    perf_fd = fd;
+    perf_page = page;
+    return true;
+}
+
+static void perf_close(void)
+{
+    if (!perf_page)
+        return;
+
+    munmap(perf_page, sysconf(_SC_PAGESIZE));
+    close(perf_fd);
+    perf_page = NULL;
+    perf_fd = -1;
+}
+
+/* Without user access to the counter, or while the kernel has it switched
+ * out, only a system call can tell its value.
+ */
+static int64_t perf_syscall(void)
+{
+    uint64_t count;
+    if (read(perf_fd, &count, sizeof(count)) != sizeof(count))
+        return CPUCYCLES_FAILED;
+    return count;
+}
+
+/* The kernel publishes in the page which hardware counter holds the event
+ * and the count it accumulated before, under a sequence lock that changes
+ * whenever the thread is switched out.
+ */
+int64_t cpucycles_perf(void)
+{
+    struct perf_event_mmap_page *pc = perf_page;
+    if (!pc)
+        return CPUCYCLES_FAILED;
+
+#if defined(__i386__) || defined(__x86_64__)
+    int64_t count;
+    uint32_t seq;
+    do {
+        seq = pc->lock;
+        __asm__ volatile("" : : : "memory");
+        uint32_t idx = pc->index;
+        if (!pc->cap_user_rdpmc || !idx)
+            return perf_syscall();
+
+        unsigned int hi, lo;
+        __asm__ volatile("lfence\n\trdpmc\n\tlfence\n\t"
+                         : "=a"(lo), "=d"(hi)
+                         : "c"(idx - 1)
+                         : "memory");
+        /* Sign extend the pmc_width bits the counter is wide */
+        int shift = 64 - pc->pmc_width;
+        uint64_t pmc = ((uint64_t) hi << 32 | lo) << shift;
+        count = pc->offset + ((int64_t) pmc >> shift);
+        __asm__ volatile("" : : : "memory");
+    } while (pc->lock != seq);
+    return count;
+#else
+    return perf_syscall();
+#endif
+}
+#else
+static bool perf_open(void)
+{
+    return false;
+}
+
+static void perf_close(void) {}
+
+int64_t cpucycles_perf(void)
+{
+    return CPUCYCLES_FAILED;
+}
+#endif
+
+bool cpucycles_select(int backend)
+{
+    switch (backend) {
+    case CPUCYCLES_PERF:
+        if (!perf_open())
+            return false;
+        break;
+    case CPUCYCLES_SERIAL:
+    case CPUCYCLES_TSC:
+    case CPUCYCLES_CLOCK:
+        perf_close();
+        break;
+    default:
+        return false;
+    }
+    cpucycles_backend = backend;
+    cpucycles_calibrate();
+    return true;
+}
+
+bool cpucycles_thread_init(void)
+{
+    return cpucycles_backend != CPUCYCLES_PERF || perf_open();
+}
+
+void cpucycles_thread_exit(void)
+{
+    perf_close();
+}
+
+void cpucycles_calibrate(void)
+{
+    cpucycles_thread_init();
+    int64_t least = INT64_MAX;
+    for (int i = 0; i < CALIBRATE_ROUNDS; i++) {
+        int64_t before = cpucycles();
+        int64_t after = cpucycles();
+        if (before == CPUCYCLES_FAILED || after == CPUCYCLES_FAILED)
+            continue;
+        if (after - before >= 0 && after - before < least)
+            least = after - before;
+    }
+    cpucycles_overhead = least == INT64_MAX ? 0 : least;
+}
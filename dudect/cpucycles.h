@@ -1,10 +1,47 @@
 #ifndef DUDECT_CPUCYCLES_H
 #define DUDECT_CPUCYCLES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/**
+ * Counters which may time the function under test, see cpucycles_backend
+ * @CPUCYCLES_SERIAL: the time-stamp counter, with the instructions around the
+ *                    read fenced so that none of them moves across it
+ * @CPUCYCLES_TSC: the time-stamp counter as is. The processor may execute
+ *                 the read before earlier instructions are done, or later
+ *                 ones before it.
+ * @CPUCYCLES_PERF: core cycles spent by the thread in user mode, counted by
+ *                  the PMU through perf_event_open(2) and read from the page
+ *                  the kernel maps for it
+ * @CPUCYCLES_CLOCK: nanoseconds of CLOCK_MONOTONIC_RAW, for when no counter
+ *                   of the CPU can be read
+ */
+enum {
+    CPUCYCLES_SERIAL,
+    CPUCYCLES_TSC,
+    CPUCYCLES_PERF,
+    CPUCYCLES_CLOCK,
+};
+
+/* The counter cpucycles() reads, only to be changed by cpucycles_select() */
+extern int cpucycles_backend;
+
+/* What cpucycles() returns when the counter could not be read, which no count
+ * of any backend can be
+ */
+#define CPUCYCLES_FAILED (-1)
+
+/* Ticks that two reads in a row of the counter take on the calling thread,
+ * see cpucycles_calibrate()
+ */
+extern _Thread_local int64_t cpucycles_overhead;
+
+int64_t cpucycles_perf(void);
+int64_t cpucycles_clock(void);
+
 // http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
-static inline int64_t cpucycles(void)
+static inline int64_t cpucycles_tsc(void)
 {
 #if defined(__i386__) || defined(__x86_64__)
     unsigned int hi, lo;
@@ -26,4 +63,72 @@ static inline int64_t cpucycles(void)
 #endif
 }
 
+/* lfence waits for all earlier instructions to complete and keeps later ones
+ * from starting, so fencing both sides of the read serves for the start as
+ * well as for the end of a measurement. isb does the same on Arm.
+ */
+static inline int64_t cpucycles_serial(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo;
+    __asm__ volatile("lfence\n\trdtsc\n\tlfence\n\t"
+                     : "=a"(lo), "=d"(hi)
+                     :
+                     : "memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+
+#elif defined(__aarch64__)
+    uint64_t val;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val) : : "memory");
+    return val;
+#else
+#error Unsupported Architecture
+#endif
+}
+
+static inline int64_t cpucycles(void)
+{
+    switch (cpucycles_backend) {
+    case CPUCYCLES_TSC:
+        return cpucycles_tsc();
+    case CPUCYCLES_PERF:
+        return cpucycles_perf();
+    case CPUCYCLES_CLOCK:
+        return cpucycles_clock();
+    default:
+        return cpucycles_serial();
+    }
+}
+
+/**
+ * cpucycles_select() - Change the counter read by cpucycles()
+ * @backend: one of CPUCYCLES_SERIAL ... CPUCYCLES_CLOCK
+ *
+ * Return: false, leaving the counter as it was, if @backend is unknown or
+ * cannot be read by this process
+ */
+bool cpucycles_select(int backend);
+
+/**
+ * cpucycles_thread_init() - Get the counter ready for the calling thread
+ *
+ * The PMU counts cycles for one thread at a time, so each thread timing
+ * anything must call this first, and cpucycles_thread_exit() before it exits.
+ *
+ * Return: false if the thread cannot get a PMU counter of its own, in which
+ * case cpucycles() returns CPUCYCLES_FAILED on it
+ */
+bool cpucycles_thread_init(void);
+void cpucycles_thread_exit(void);
+
+/**
+ * cpucycles_calibrate() - Measure the overhead of the counter
+ *
+ * Set cpucycles_overhead of the calling thread to the least difference
+ * between two reads in a row, which is what any measurement taken between two
+ * reads includes on top of the code measured. Each thread timing anything
+ * calibrates its own counter.
+ */
+void cpucycles_calibrate(void);
+
 #endif
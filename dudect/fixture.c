@@ -22,12 +22,41 @@
  *    probably redundant since we're doing as well a t-test on cropped
  *    measurements (non-linear transform)
  *
- *  - as long as any of the different test fails, the code will be deemed
- *    variable time.
+ *  - as long as the uncropped test, the second order test or most of the
+ *    cropped tests fail, the code will be deemed variable time.
+ *
+ *  - the cropping thresholds, i.e. the percentiles of the execution time, are
+ *    estimated once, from a warm-up batch measured before the tests. The
+ *    second order test centers its samples on the running mean of their
+ *    class, once that holds SECOND_ORDER_MIN samples.
+ *    Only tests holding at least half of ENOUGH_MEASURE samples take part in
+ *    the verdict. The cropped tests take part through their median t, so
+ *    that a leak has to show in at least half of the crops.
+ *
+ *  - operations expected to take time linear in the length of the queue are
+ *    not t-tested. Their median time for each of several sizes makes up a
+ *    curve, whose exponent of growth is fitted on a log-log scale. No verdict
+ *    is drawn from it: caches make the time per element jump as the queue
+ *    outgrows them, which a fixed bound on the exponent would mistake for
+ *    worse complexity.
+ *
+ *  - with dudect_threads above one, the batches of measurements are shared
+ *    out among threads pinned to distinct CPUs, each with statistics of its
+ *    own, which are merged once all of them are done.
+ */
+
+/* CPU affinity is a GNU extension on Linux, which has to be requested before
+ * any header is included.
  */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,14 +66,31 @@
 #include "../random.h"
 
 #include "constant.h"
+#include "cpucycles.h"
 #include "fixture.h"
 #include "ttest.h"
 
 #define ENOUGH_MEASURE 10000
 #define TEST_TRIES 10
 
+/* Battery of tests: uncropped, cropped at each percentile, second order */
+#define N_PERCENTILES 100
+#define SECOND_ORDER (N_PERCENTILES + 1)
+#define N_TESTS (N_PERCENTILES + 2)
+
+/* Samples of a class before the second order test trusts its mean */
+#define SECOND_ORDER_MIN 100
+
+/* Batches timed for an operation expected to take linear time */
+#define SCALING_BATCHES 20
+
 static t_context_t *t;
 
+/* Estimated from the warm-up batch */
+static int64_t percentiles[N_PERCENTILES];
+
+int dudect_threads = 1;
+
 /* threshold values for Welch's t-test */
 enum {
     t_threshold_bananas = 500, /* Test failed with overwhelming probability */
@@ -56,15 +102,56 @@ static void __attribute__((noreturn)) die(void)
     exit(111);
 }
 
+/* The overhead of the counter itself is taken off, so that the times left
+ * are those of the code under test. A measurement for which the counter could
+ * not be read is dropped.
+ */
 static void differentiate(int64_t *exec_times,
                           const int64_t *before_ticks,
                           const int64_t *after_ticks)
 {
-    for (size_t i = 0; i < N_MEASURES; i++)
-        exec_times[i] = after_ticks[i] - before_ticks[i];
+    for (size_t i = 0; i < N_MEASURES; i++) {
+        if (before_ticks[i] == CPUCYCLES_FAILED ||
+            after_ticks[i] == CPUCYCLES_FAILED) {
+            exec_times[i] = 0;
+            continue;
+        }
+        exec_times[i] =
+            after_ticks[i] - before_ticks[i] - cpucycles_overhead;
+    }
 }
 
-static void update_statistics(const int64_t *exec_times, uint8_t *classes)
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Set the cropping thresholds from a warm-up batch.
+ * Threshold i keeps the fastest 1 - 0.5^(10 (i + 1) / N_PERCENTILES) of the
+ * samples, so that most of them crop only the far end of the tail.
+ */
+static void set_thresholds(const int64_t *exec_times)
+{
+    int64_t sorted[N_MEASURES];
+    size_t count = 0;
+    for (size_t i = 0; i < N_MEASURES; i++) {
+        if (exec_times[i] > 0)
+            sorted[count++] = exec_times[i];
+    }
+    if (!count)
+        die();
+
+    qsort(sorted, count, sizeof(int64_t), cmp_int64);
+    for (size_t i = 0; i < N_PERCENTILES; i++) {
+        double which = 1 - pow(0.5, 10.0 * (i + 1) / N_PERCENTILES);
+        percentiles[i] = sorted[(size_t) (which * count)];
+    }
+}
+
+static void update_statistics(t_context_t *t,
+                              const int64_t *exec_times,
+                              uint8_t *classes)
 {
     for (size_t i = 0; i < N_MEASURES; i++) {
         int64_t difference = exec_times[i];
@@ -73,21 +160,85 @@ static void update_statistics(const int64_t *exec_times, uint8_t *classes)
             continue;
 
         /* do a t-test on the execution time */
-        t_push(t, difference, classes[i]);
+        t_push(&t[0], difference, classes[i]);
+
+        /* do a t-test on cropped execution times, for several cropping
+         * thresholds.
+         */
+        for (size_t crop = 0; crop < N_PERCENTILES; crop++) {
+            if (difference < percentiles[crop])
+                t_push(&t[crop + 1], difference, classes[i]);
+        }
+
+        /* do a second order test, on the centered square of the execution
+         * time, which tells a difference of variance. A mean estimated
+         * from a few samples would be off by more for one class than for
+         * the other, which the test would take for a difference.
+         */
+        if (t[0].n[classes[i]] < SECOND_ORDER_MIN)
+            continue;
+        double centered = difference - t[0].mean[classes[i]];
+        t_push(&t[SECOND_ORDER], centered * centered, classes[i]);
     }
 }
 
+static bool enough_samples(const t_context_t *test)
+{
+    return test->n[0] + test->n[1] >= ENOUGH_MEASURE / 2;
+}
+
+/* Order cropped tests by increasing |t| */
+static int cmp_crop(const void *a, const void *b)
+{
+    double x = fabs(t_compute(&t[*(const int *) a]));
+    double y = fabs(t_compute(&t[*(const int *) b]));
+    return (x > y) - (x < y);
+}
+
+/* Index of the test the verdict goes by: the one with the largest t among
+ * the uncropped test, the second order test and the median cropped test.
+ * A leak shifts the bulk of the distribution and shows in most crops, while
+ * noise in the tail only sways a few of them, so the cropped tests have to
+ * agree, at least half of them, before they reject.
+ */
+static int max_test(void)
+{
+    int crops[N_PERCENTILES];
+    int n = 0;
+    for (int i = 1; i <= N_PERCENTILES; i++) {
+        if (enough_samples(&t[i]))
+            crops[n++] = i;
+    }
+    qsort(crops, n, sizeof(int), cmp_crop);
+
+    int candidates[] = {0, SECOND_ORDER, n ? crops[n / 2] : 0};
+    int max = 0;
+    double max_t = 0.0;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        int test = candidates[i];
+        if (!enough_samples(&t[test]))
+            continue;
+        double x = fabs(t_compute(&t[test]));
+        if (x > max_t) {
+            max_t = x;
+            max = test;
+        }
+    }
+    return max;
+}
+
 static bool report(void)
 {
-    double max_t = fabs(t_compute(t));
-    double number_traces_max_t = t->n[0] + t->n[1];
+    int test = max_test();
+    double max_t = fabs(t_compute(&t[test]));
+    double number_traces_max_t = t[test].n[0] + t[test].n[1];
     double max_tau = max_t / sqrt(number_traces_max_t);
 
     printf("\033[A\033[2K");
     printf("meas: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < ENOUGH_MEASURE) {
+    if (t[0].n[0] + t[0].n[1] < ENOUGH_MEASURE) {
         printf("not enough measurements (%.0f still to go).\n",
-               ENOUGH_MEASURE - number_traces_max_t);
+               ENOUGH_MEASURE - (t[0].n[0] + t[0].n[1]));
         return false;
     }
 
@@ -116,7 +267,10 @@ static bool report(void)
     return true;
 }
 
-static bool doit(int mode)
+/* Measure one batch of executions and add them to the tests @t, or, with @t
+ * NULL, estimate the thresholds from them.
+ */
+static bool measure_batch(t_context_t *t, int mode)
 {
     int64_t *before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
     int64_t *after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
@@ -133,8 +287,10 @@ static bool doit(int mode)
 
     bool ret = measure(before_ticks, after_ticks, input_data, mode);
     differentiate(exec_times, before_ticks, after_ticks);
-    update_statistics(exec_times, classes);
-    ret &= report();
+    if (t)
+        update_statistics(t, exec_times, classes);
+    else
+        set_thresholds(exec_times);
 
     free(before_ticks);
     free(after_ticks);
@@ -145,23 +301,166 @@ static bool doit(int mode)
     return ret;
 }
 
+static bool doit(int mode)
+{
+    bool ret = measure_batch(t, mode);
+    ret &= report();
+    return ret;
+}
+
+typedef struct {
+    int mode;
+    int batches;
+    int cpu; /* CPU to run on, or -1 to leave it to the scheduler */
+    bool counted; /* Whether the thread could get the counter ready */
+    bool ok;
+    t_context_t t[N_TESTS];
+    pthread_t thread;
+} worker_t;
+
+/* Measure the batches of @w on the calling thread, whose counter is ready */
+static void run_batches(worker_t *w)
+{
+    for (int i = 0; i < N_TESTS; i++)
+        t_init(&w->t[i]);
+    w->ok = true;
+    for (int i = 0; i < w->batches; i++)
+        w->ok &= measure_batch(w->t, w->mode);
+}
+
+/* A thread which cannot get the counter of the others ready measures nothing,
+ * as samples of another counter could not be merged with theirs.
+ */
+static void *measure_worker(void *arg)
+{
+    worker_t *w = arg;
+
+#if defined(__linux__)
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    w->counted = cpucycles_thread_init();
+    if (w->counted) {
+        cpucycles_calibrate();
+        run_batches(w);
+    }
+    cpucycles_thread_exit();
+    return NULL;
+}
+
+/* Give each of the @n workers a CPU of its own among those the process may
+ * run on. Return how many could be given one, or @n if that is unknown.
+ */
+static int assign_cpus(worker_t *w, int n)
+{
+    for (int i = 0; i < n; i++)
+        w[i].cpu = -1;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set))
+        return n;
+
+    int found = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && found < n; cpu++) {
+        if (CPU_ISSET(cpu, &set))
+            w[found++].cpu = cpu;
+    }
+    return found;
+#else
+    return n;
+#endif
+}
+
+/* Run @batches batches on dudect_threads threads and merge their statistics
+ * into t. No more threads are used than there are CPUs, as threads sharing a
+ * CPU would disturb each other's timings. If any thread could not get the
+ * counter ready, all batches are run again on the calling thread.
+ */
+static bool doit_parallel(int mode, int batches)
+{
+    worker_t *w = calloc(dudect_threads, sizeof(worker_t));
+    if (!w)
+        die();
+
+    int n = assign_cpus(w, dudect_threads < batches ? dudect_threads : batches);
+    /* Signals such as SIGALRM are left to the main thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int started = 0;
+    for (int i = 0; i < n; i++) {
+        w[i].mode = mode;
+        w[i].batches = batches / n + (i < batches % n);
+        if (!pthread_create(&w[i].thread, NULL, measure_worker, &w[i]))
+            started = i + 1;
+        else
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    /* Run the batches of the threads which could not be started here */
+    for (int i = started; i < n; i++) {
+        w[i].cpu = -1;
+        w[i].counted = true;
+        run_batches(&w[i]);
+    }
+
+    bool ret = true, counted = true;
+    for (int i = 0; i < n; i++) {
+        if (i < started)
+            pthread_join(w[i].thread, NULL);
+        counted &= w[i].counted;
+    }
+    for (int i = 0; counted && i < n; i++) {
+        for (int j = 0; j < N_TESTS; j++)
+            t_merge(&t[j], &w[i].t[j]);
+        ret &= w[i].ok;
+    }
+    free(w);
+
+    if (!counted) {
+        for (int i = 0; i < batches; i++)
+            ret &= measure_batch(t, mode);
+    }
+
+    ret &= report();
+    return ret;
+}
+
 static void init_once(void)
 {
     init_dut();
-    t_init(t);
+    for (int i = 0; i < N_TESTS; i++)
+        t_init(&t[i]);
 }
 
 static bool test_const(char *text, int mode)
 {
     bool result = false;
-    t = malloc(sizeof(t_context_t));
+    t = malloc(N_TESTS * sizeof(t_context_t));
+    if (!t)
+        die();
+
+    init_dut();
+    cpucycles_calibrate();
+    measure_batch(NULL, mode);
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
         printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
         init_once();
-        for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
-             ++i)
-            result = doit(mode);
+        int batches = ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
+        if (dudect_threads > 1) {
+            result = doit_parallel(mode, batches);
+        } else {
+            for (int i = 0; i < batches; ++i)
+                result = doit(mode);
+        }
         printf("\033[A\033[2K\033[A\033[2K");
         if (result)
             break;
@@ -170,9 +469,98 @@ static bool test_const(char *text, int mode)
     return result;
 }
 
-#define DUT_FUNC_IMPL(op) \
+/* Per-sample size of the queue and time of an operation timed for scaling */
+typedef struct {
+    int size;
+    int64_t ticks;
+} sample_t;
+
+static int cmp_sample(const void *a, const void *b)
+{
+    const sample_t *x = a, *y = b;
+    if (x->size != y->size)
+        return (x->size > y->size) - (x->size < y->size);
+    return (x->ticks > y->ticks) - (x->ticks < y->ticks);
+}
+
+/* Time an operation expected to take linear time on queues of many sizes,
+ * report the median time for each size, and fit time = c * size^k to the
+ * medians on a log-log scale. Return false only if the operation left the
+ * queue with a wrong length.
+ */
+static bool test_scaling(char *text, int mode)
+{
+    size_t per_batch = N_MEASURES - DROP_SIZE * 2;
+    sample_t *samples = calloc(SCALING_BATCHES * per_batch, sizeof(sample_t));
+    int64_t *before_ticks = calloc(N_MEASURES, sizeof(int64_t));
+    int64_t *after_ticks = calloc(N_MEASURES, sizeof(int64_t));
+    int64_t *exec_times = calloc(N_MEASURES, sizeof(int64_t));
+    uint8_t *classes = calloc(N_MEASURES, sizeof(uint8_t));
+    uint8_t *input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
+    if (!samples || !before_ticks || !after_ticks || !exec_times ||
+        !classes || !input_data) {
+        die();
+    }
+
+    init_dut();
+    cpucycles_calibrate();
+
+    bool ok = true;
+    size_t n = 0;
+    for (int b = 0; ok && b < SCALING_BATCHES; b++) {
+        prepare_inputs(input_data, classes);
+        /* There are no classes, every size is drawn at random */
+        randombytes(input_data, N_MEASURES * CHUNK_SIZE);
+        ok = measure(before_ticks, after_ticks, input_data, mode);
+        differentiate(exec_times, before_ticks, after_ticks);
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            if (exec_times[i] <= 0)
+                continue;
+            samples[n].size = dut_length(mode, input_data + i * CHUNK_SIZE);
+            samples[n++].ticks = exec_times[i];
+        }
+    }
+
+    printf("Scaling of %s:\n", text);
+    qsort(samples, n, sizeof(sample_t), cmp_sample);
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    int points = 0;
+    for (size_t i = 0, j; i < n; i = j) {
+        for (j = i; j < n && samples[j].size == samples[i].size; j++)
+            ;
+        int64_t median = samples[(i + j) / 2].ticks;
+        printf("%8d elements: %10lld ticks\n", samples[i].size,
+               (long long) median);
+
+        double x = log(samples[i].size), y = log(median);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        points++;
+    }
+
+    double exponent = NAN;
+    if (points >= 2)
+        exponent = (points * sxy - sx * sy) / (points * sxx - sx * sx);
+    printf("time grows as size^%.2f\n", exponent);
+
+    free(samples);
+    free(before_ticks);
+    free(after_ticks);
+    free(exec_times);
+    free(classes);
+    free(input_data);
+
+    return ok;
+}
+
+#define DUT_IMPL_DUT_CONSTANT(op) \
     bool is_##op##_const(void) { return test_const(#op, DUT(op)); }
 
-#define _(x) DUT_FUNC_IMPL(x)
+#define DUT_IMPL_DUT_LINEAR(op) \
+    bool profile_##op(void) { return test_scaling(#op, DUT(op)); }
+
+#define _(x, scaling, min_size, change) DUT_IMPL_##scaling(x)
 DUT_FUNCS
 #undef _
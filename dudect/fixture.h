@@ -4,8 +4,17 @@
 #include <stdbool.h>
 #include "constant.h"
 
-/* Interface to test if function is constant */
-#define _(x) bool is_##x##_const(void);
+/* Number of threads taking measurements at once, each on a CPU of its own */
+extern int dudect_threads;
+
+/* Interface to test if function is constant, or for those expected to take
+ * linear time, to report how their time grows. The latter only fail if the
+ * queue is left with a wrong length.
+ */
+#define DUT_DECL_DUT_CONSTANT(x) bool is_##x##_const(void);
+#define DUT_DECL_DUT_LINEAR(x) bool profile_##x(void);
+
+#define _(x, scaling, min_size, change) DUT_DECL_##scaling(x)
 DUT_FUNCS
 #undef _
 
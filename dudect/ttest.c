@@ -38,6 +38,24 @@ double t_compute(t_context_t *ctx)
     return t_value;
 }
 
+/* Add the samples accumulated in @other to @ctx, as if they had been pushed
+ * there, by the pairwise update of Chan, Golub and LeVeque.
+ */
+void t_merge(t_context_t *ctx, const t_context_t *other)
+{
+    for (int class = 0; class < 2; class ++) {
+        double n = ctx->n[class] + other->n[class];
+        if (!other->n[class])
+            continue;
+
+        double delta = other->mean[class] - ctx->mean[class];
+        ctx->mean[class] += delta * other->n[class] / n;
+        ctx->m2[class] += other->m2[class] +
+                          delta * delta * ctx->n[class] * other->n[class] / n;
+        ctx->n[class] = n;
+    }
+}
+
 void t_init(t_context_t *ctx)
 {
     for (int class = 0; class < 2; class ++) {
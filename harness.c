@@ -1,13 +1,16 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "random.h"
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -44,8 +47,101 @@ typedef struct __block_element {
 static block_element_t *allocated = NULL;
 static size_t allocated_count = 0;
 
-/* Percent probability of malloc failure */
+/* Serialize the bookkeeping of blocks, which may be allocated and freed from
+ * several threads at once when queue operations run in parallel.
+ */
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Open-addressing hash set holding the address of every allocated block,
+ * which lets cautious mode check that a block is allocated in O(1) instead of
+ * walking the whole list. It uses linear probing with backward-shift deletion,
+ * so no tombstones are needed, and grows to keep at most half of the slots
+ * occupied.
+ */
+#define OWNED_MIN_BITS 10
+
+static block_element_t **owned = NULL;
+static size_t owned_mask = 0;
+static int owned_bits = 0;
+static size_t owned_count = 0;
+
+/* Size-class slab arena
+ *
+ * When enabled, a block whose total size, i.e. header, payload and footer,
+ * does not exceed ARENA_MAX_BLOCK is carved out of a large chunk obtained from
+ * malloc instead of being allocated on its own. Freed blocks are pushed onto
+ * the free list of their size class, linked via the 'next' field of the
+ * header, and handed out again by the next allocation of that class. Blocks
+ * keep the same layout either way, so the magic number checks and the list of
+ * allocated blocks work unchanged.
+ */
+#define ARENA_ALIGN 16
+#define ARENA_MAX_BLOCK 512
+#define ARENA_CLASSES (ARENA_MAX_BLOCK / ARENA_ALIGN)
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+typedef struct __arena_chunk {
+    struct __arena_chunk *next;
+    /* Keep the blocks carved out of the chunk aligned */
+    unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+} arena_chunk_t;
+
+static bool arena_mode = false;
+static arena_chunk_t *arena_chunks = NULL;
+static unsigned char *arena_cur = NULL, *arena_end = NULL;
+static block_element_t *arena_free[ARENA_CLASSES];
+
+/* Per-thread magazines
+ *
+ * When enabled, blocks whose total size does not exceed ARENA_MAX_BLOCK are
+ * served from a cache private to the calling thread, which holds a few free
+ * blocks of every size class. An empty magazine is refilled with
+ * MAGAZINE_BATCH blocks from the arena, which serves as the depot shared by
+ * all threads, and a magazine holding twice as many returns a batch to it,
+ * so that alloc_lock is only taken once per batch. Blocks served this way are
+ * not kept on the list of allocated blocks; instead each magazine counts the
+ * blocks its thread allocated minus those it freed, and allocation_check()
+ * adds up these counts, so that leaks are still counted exactly. Nor are
+ * they entered in the hash set of owned blocks, even in cautious mode, as
+ * that would take alloc_lock for every block again: freeing one only checks
+ * its magic numbers.
+ */
+#define MAGAZINE_BATCH 32
+
+typedef struct __magazine {
+    struct __magazine *next; /* Every magazine, linked under alloc_lock */
+    atomic_long count;       /* Only updated by the owning thread */
+    block_element_t *free[ARENA_CLASSES];
+    int nfree[ARENA_CLASSES];
+} magazine_t;
+
+static bool magazine_mode = false;
+static magazine_t *magazines = NULL;
+static pthread_key_t magazine_key;
+static pthread_once_t magazine_once = PTHREAD_ONCE_INIT;
+static _Thread_local magazine_t *my_magazine = NULL;
+
+/* Fault injection
+ *
+ * While a schedule is armed, allocations are numbered from the last call to
+ * fault_reset() on, and allocation number n fails if n is fail_nth, if its
+ * block falls into size class fail_class, or at random with probability
+ * fail_probability percent. The random draw hashes n with the seed, so
+ * whether an allocation fails only depends on the seed and its number, and
+ * the failures of a run can be replayed exactly, whichever thread makes the
+ * allocations. When no schedule is armed, allocating costs a single test.
+ * With fail_class at -2, the class of the first allocation which fails is
+ * the one failing from then on.
+ */
 int fail_probability = 0;
+int fail_nth = 0;
+int fail_class = -1;
+
+static bool fault_armed = false;
+static uintptr_t fault_seed = 0;
+static uintptr_t fault_threshold = 0;
+static atomic_ulong fault_serial;
+static atomic_long fault_class = -1;
 
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
@@ -67,11 +163,90 @@ typedef enum {
 
 /* Internal functions */
 
-/* Should this allocation fail? */
-static bool fail_allocation()
+/* Home slot of block @b.
+ * Blocks allocated one after another tend to have nearby addresses, so the
+ * address is used almost as is to keep them in nearby slots, which is far
+ * more cache friendly than scattering them. Folding the upper bits in avoids
+ * piling up blocks whose addresses are a multiple of the table size apart.
+ */
+static inline size_t owned_slot(const block_element_t *b)
+{
+    uintptr_t x = (uintptr_t) b >> 4;
+    return (x ^ (x >> owned_bits)) & owned_mask;
+}
+
+static bool owned_contains(const block_element_t *b)
+{
+    if (!owned)
+        return false;
+
+    for (size_t i = owned_slot(b); owned[i]; i = (i + 1) & owned_mask) {
+        if (owned[i] == b)
+            return true;
+    }
+    return false;
+}
+
+static void owned_grow(void)
+{
+    int bits = owned ? owned_bits + 1 : OWNED_MIN_BITS;
+    size_t old_capacity = owned ? owned_mask + 1 : 0;
+    block_element_t **old = owned;
+
+    owned = calloc((size_t) 1 << bits, sizeof(block_element_t *));
+    if (!owned)
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+    owned_mask = ((size_t) 1 << bits) - 1;
+    owned_bits = bits;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!old[i])
+            continue;
+        size_t j = owned_slot(old[i]);
+        while (owned[j])
+            j = (j + 1) & owned_mask;
+        owned[j] = old[i];
+    }
+    free(old);
+}
+
+static void owned_insert(block_element_t *b)
+{
+    if (!owned || (owned_count + 1) * 2 > owned_mask + 1)
+        owned_grow();
+
+    size_t i = owned_slot(b);
+    while (owned[i])
+        i = (i + 1) & owned_mask;
+    owned[i] = b;
+    owned_count++;
+}
+
+static void owned_remove(const block_element_t *b)
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    if (!owned)
+        return;
+
+    size_t i = owned_slot(b);
+    while (owned[i] != b) {
+        if (!owned[i])
+            return;
+        i = (i + 1) & owned_mask;
+    }
+
+    /* Move back any later entry of the cluster whose home slot is not
+     * cyclically within (i, j], so that lookups never stop at the hole.
+     */
+    for (size_t j = (i + 1) & owned_mask; owned[j]; j = (j + 1) & owned_mask) {
+        size_t k = owned_slot(owned[j]);
+        bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            owned[i] = owned[j];
+            i = j;
+        }
+    }
+    owned[i] = NULL;
+    owned_count--;
 }
 
 /* Find header of block, given its payload.
@@ -88,13 +263,7 @@ static block_element_t *find_header(void *p)
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (!owned_contains(b)) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
@@ -122,6 +291,229 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
+/* Total size of a block holding @payload_size bytes */
+static inline size_t block_size(size_t payload_size)
+{
+    return payload_size + sizeof(block_element_t) + sizeof(size_t);
+}
+
+/* Size classes are ARENA_ALIGN bytes apart */
+static inline size_t arena_class(size_t total)
+{
+    return (total - 1) / ARENA_ALIGN;
+}
+
+static block_element_t *arena_alloc(size_t total)
+{
+    size_t class = arena_class(total);
+    block_element_t *b = arena_free[class];
+    if (b) {
+        arena_free[class] = b->next;
+        return b;
+    }
+
+    size_t bytes = (class + 1) * ARENA_ALIGN;
+    if ((size_t) (arena_end - arena_cur) < bytes) {
+        /* The tail of the previous chunk, if any, is simply left unused */
+        arena_chunk_t *chunk = malloc(ARENA_CHUNK_SIZE);
+        if (!chunk)
+            return NULL;
+        chunk->next = arena_chunks;
+        arena_chunks = chunk;
+        arena_cur = chunk->data;
+        arena_end = (unsigned char *) chunk + ARENA_CHUNK_SIZE;
+    }
+
+    b = (block_element_t *) arena_cur;
+    arena_cur += bytes;
+    return b;
+}
+
+static void arena_release(block_element_t *b, size_t total)
+{
+    size_t class = arena_class(total);
+    b->next = arena_free[class];
+    arena_free[class] = b;
+}
+
+/* Return every chunk to the system. No block may be in use. */
+static void arena_destroy(void)
+{
+    while (arena_chunks) {
+        arena_chunk_t *chunk = arena_chunks;
+        arena_chunks = chunk->next;
+        free(chunk);
+    }
+    arena_cur = arena_end = NULL;
+    memset(arena_free, 0, sizeof(arena_free));
+}
+
+/* Return @n blocks of size class @class from @m to the arena.
+ * Called with alloc_lock held.
+ */
+static void magazine_flush(magazine_t *m, size_t class, int n)
+{
+    for (; n > 0; n--) {
+        block_element_t *b = m->free[class];
+        m->free[class] = b->next;
+        m->nfree[class]--;
+        arena_release(b, (class + 1) * ARENA_ALIGN);
+    }
+}
+
+/* Give the blocks of an exiting thread back, and keep its count */
+static void magazine_destroy(void *data)
+{
+    magazine_t *m = data;
+
+    pthread_mutex_lock(&alloc_lock);
+    for (size_t class = 0; class < ARENA_CLASSES; class++)
+        magazine_flush(m, class, m->nfree[class]);
+    allocated_count += atomic_load(&m->count);
+    magazine_t **pp = &magazines;
+    while (*pp != m)
+        pp = &(*pp)->next;
+    *pp = m->next;
+    pthread_mutex_unlock(&alloc_lock);
+
+    free(m);
+    my_magazine = NULL;
+}
+
+static void magazine_key_create(void)
+{
+    pthread_key_create(&magazine_key, magazine_destroy);
+}
+
+/* Magazine of the calling thread, set up on first use */
+static magazine_t *magazine_get(void)
+{
+    if (my_magazine)
+        return my_magazine;
+
+    magazine_t *m = calloc(1, sizeof(magazine_t));
+    if (!m)
+        return NULL;
+    pthread_once(&magazine_once, magazine_key_create);
+    pthread_setspecific(magazine_key, m);
+
+    pthread_mutex_lock(&alloc_lock);
+    m->next = magazines;
+    magazines = m;
+    pthread_mutex_unlock(&alloc_lock);
+
+    my_magazine = m;
+    return m;
+}
+
+static inline void magazine_count(magazine_t *m, long delta)
+{
+    long count = atomic_load_explicit(&m->count, memory_order_relaxed);
+    atomic_store_explicit(&m->count, count + delta, memory_order_relaxed);
+}
+
+static block_element_t *magazine_alloc(size_t total)
+{
+    magazine_t *m = magazine_get();
+    if (!m)
+        return NULL;
+
+    size_t class = arena_class(total);
+    if (!m->nfree[class]) {
+        pthread_mutex_lock(&alloc_lock);
+        while (m->nfree[class] < MAGAZINE_BATCH) {
+            block_element_t *b = arena_alloc(total);
+            if (!b)
+                break;
+            b->next = m->free[class];
+            m->free[class] = b;
+            m->nfree[class]++;
+        }
+        pthread_mutex_unlock(&alloc_lock);
+        if (!m->nfree[class])
+            return NULL;
+    }
+
+    block_element_t *b = m->free[class];
+    m->free[class] = b->next;
+    m->nfree[class]--;
+    magazine_count(m, 1);
+    return b;
+}
+
+static void magazine_release(block_element_t *b, size_t total)
+{
+    magazine_t *m = magazine_get();
+    if (!m) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        return;
+    }
+
+    size_t class = arena_class(total);
+    b->next = m->free[class];
+    m->free[class] = b;
+    m->nfree[class]++;
+    magazine_count(m, -1);
+
+    if (m->nfree[class] >= 2 * MAGAZINE_BATCH) {
+        pthread_mutex_lock(&alloc_lock);
+        magazine_flush(m, class, MAGAZINE_BATCH);
+        pthread_mutex_unlock(&alloc_lock);
+    }
+}
+
+/* Fill in the header and footer of a new block, and its payload */
+static void *init_block(block_element_t *b, size_t size, alloc_t alloc_type)
+{
+    // cppcheck-suppress nullPointerRedundantCheck
+    b->magic_header = MAGICHEADER;
+    // cppcheck-suppress nullPointerRedundantCheck
+    b->payload_size = size;
+    *find_footer(b) = MAGICFOOTER;
+    void *p = (void *) &b->payload;
+    memset(p, !alloc_type * FILLCHAR, size);
+    return p;
+}
+
+/* Check the footer of a block about to be freed, and mark it as free */
+static void retire_block(block_element_t *b, void *p)
+{
+    size_t footer = *find_footer(b);
+    if (footer != MAGICFOOTER) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in block with address %p when "
+                     "attempting to free it",
+                     p);
+        error_occurred = true;
+    }
+    b->magic_header = MAGICFREE;
+    *find_footer(b) = MAGICFREE;
+    memset(p, FILLCHAR, b->payload_size);
+}
+
+/* Should this allocation of a block of @total bytes fail?
+ * Return its number if so, 0 otherwise.
+ */
+static unsigned long fail_allocation(size_t total)
+{
+    unsigned long n =
+        atomic_fetch_add_explicit(&fault_serial, 1, memory_order_relaxed) + 1;
+    long class = arena_class(total);
+    bool fail = n == (unsigned long) fail_nth ||
+                class == atomic_load_explicit(&fault_class,
+                                              memory_order_relaxed);
+    if (!fail) {
+        /* Weyl sequence, as in splitmix */
+        uintptr_t x = fault_seed + n * (uintptr_t) SPLITMIX64_GAMMA;
+        fail = random_shuffle(x) < fault_threshold;
+    }
+    if (fail && fail_class == -2) {
+        long none = -1;
+        atomic_compare_exchange_strong(&fault_class, &none, class);
+    }
+    return fail ? n : 0;
+}
+
 static void *alloc(alloc_t alloc_type, size_t size)
 {
     if (noallocate_mode) {
@@ -133,29 +525,39 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
-    if (fail_allocation()) {
+    size_t total = block_size(size);
+    unsigned long n = fault_armed ? fail_allocation(total) : 0;
+    if (n) {
         char *msg_alloc_failure[] = {
             "Malloc returning NULL",
             "Calloc returning NULL",
         };
-        report_event(MSG_WARN, "%s", msg_alloc_failure[alloc_type]);
+        report_event(MSG_WARN, "%s (allocation %lu, size class %zu)",
+                     msg_alloc_failure[alloc_type], n, arena_class(total));
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    if (magazine_mode && total <= ARENA_MAX_BLOCK) {
+        block_element_t *new_block = magazine_alloc(total);
+        if (!new_block) {
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+            error_occurred = true;
+        }
+        // cppcheck-suppress nullPointerRedundantCheck
+        new_block->next = new_block->prev = NULL;
+        return init_block(new_block, size, alloc_type);
+    }
+
+    pthread_mutex_lock(&alloc_lock);
+    block_element_t *new_block = arena_mode && total <= ARENA_MAX_BLOCK
+                                     ? arena_alloc(total)
+                                     : malloc(total);
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
     }
 
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
-    void *p = (void *) &new_block->payload;
-    memset(p, !alloc_type * FILLCHAR, size);
+    void *p = init_block(new_block, size, alloc_type);
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->next = allocated;
     // cppcheck-suppress nullPointerRedundantCheck
@@ -164,7 +566,9 @@ static void *alloc(alloc_t alloc_type, size_t size)
     if (allocated)
         allocated->prev = new_block;
     allocated = new_block;
+    owned_insert(new_block);
     allocated_count++;
+    pthread_mutex_unlock(&alloc_lock);
 
     return p;
 }
@@ -197,18 +601,28 @@ void test_free(void *p)
     if (!p)
         return;
 
-    block_element_t *b = find_header(p);
-    size_t footer = *find_footer(b);
-    if (footer != MAGICFOOTER) {
-        report_event(MSG_ERROR,
-                     "Corruption detected in block with address %p when "
-                     "attempting to free it",
-                     p);
-        error_occurred = true;
+    if (magazine_mode) {
+        block_element_t *b =
+            (block_element_t *) ((size_t) p - sizeof(block_element_t));
+        if (b->magic_header != MAGICHEADER) {
+            report_event(MSG_ERROR,
+                         "Attempted to free unallocated or corrupted block.  "
+                         "Address = %p",
+                         p);
+            error_occurred = true;
+            return;
+        }
+        size_t total = block_size(b->payload_size);
+        if (total <= ARENA_MAX_BLOCK) {
+            retire_block(b, p);
+            magazine_release(b, total);
+            return;
+        }
     }
-    b->magic_header = MAGICFREE;
-    *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
+
+    pthread_mutex_lock(&alloc_lock);
+    block_element_t *b = find_header(p);
+    retire_block(b, p);
 
     /* Unlink from list */
     block_element_t *bn = b->next;
@@ -219,9 +633,15 @@ void test_free(void *p)
         allocated = bn;
     if (bn)
         bn->prev = bp;
+    owned_remove(b);
 
-    free(b);
+    size_t total = block_size(b->payload_size);
+    if (arena_mode && total <= ARENA_MAX_BLOCK)
+        arena_release(b, total);
+    else
+        free(b);
     allocated_count--;
+    pthread_mutex_unlock(&alloc_lock);
 }
 
 // cppcheck-suppress unusedFunction
@@ -237,7 +657,12 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    pthread_mutex_lock(&alloc_lock);
+    size_t count = allocated_count;
+    for (magazine_t *m = magazines; m; m = m->next)
+        count += atomic_load_explicit(&m->count, memory_order_relaxed);
+    pthread_mutex_unlock(&alloc_lock);
+    return count;
 }
 
 /* Implementation of functions for testing */
@@ -258,6 +683,74 @@ void set_noallocate_mode(bool noallocate)
     noallocate_mode = noallocate;
 }
 
+/* Number allocations from zero again, and arm the schedule of failures if
+ * any is set. To be called whenever the schedule changes.
+ */
+void fault_reset(void)
+{
+    int percent = fail_probability < 0 ? 0 : fail_probability;
+    fault_threshold =
+        percent >= 100 ? UINTPTR_MAX : percent * (UINTPTR_MAX / 100);
+    fault_armed = percent || fail_nth > 0 || fail_class >= 0;
+    atomic_store(&fault_serial, 0);
+    atomic_store(&fault_class, fail_class >= 0 ? fail_class : -1);
+}
+
+bool fault_scheduled(void)
+{
+    return fault_armed;
+}
+
+/* Seed the random failures, and number allocations from zero again */
+void set_fault_seed(uintptr_t seed)
+{
+    fault_seed = seed;
+    fault_reset();
+}
+
+/* Switch between the slab arena and plain malloc for small blocks.
+ * Refused while any block is allocated, as it would be released to the wrong
+ * allocator. Leaving the arena returns its memory to the system.
+ */
+bool set_arena_mode(bool arena)
+{
+    if (arena == arena_mode)
+        return true;
+    if (allocation_check())
+        return false;
+
+    /* Magazines are refilled from the arena */
+    if (!arena && !magazine_mode)
+        arena_destroy();
+    arena_mode = arena;
+    return true;
+}
+
+/* Switch per-thread magazines on or off for small blocks.
+ * Refused while any block is allocated. No other thread may allocate or free
+ * meanwhile, so switching off can gather the blocks of every magazine.
+ */
+bool set_magazine_mode(bool magazine)
+{
+    if (magazine == magazine_mode)
+        return true;
+    if (allocation_check())
+        return false;
+
+    pthread_mutex_lock(&alloc_lock);
+    if (!magazine) {
+        for (magazine_t *m = magazines; m; m = m->next) {
+            for (size_t class = 0; class < ARENA_CLASSES; class++)
+                magazine_flush(m, class, m->nfree[class]);
+        }
+        if (!arena_mode)
+            arena_destroy();
+    }
+    magazine_mode = magazine;
+    pthread_mutex_unlock(&alloc_lock);
+    return true;
+}
+
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
@@ -4,6 +4,7 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
@@ -24,9 +25,37 @@ size_t allocation_check();
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Number of the allocation which fails, counted from the last fault_reset(),
+ * or 0 for none
+ */
+extern int fail_nth;
+
+/* Size class, in 16-byte steps of the whole block, in which every allocation
+ * fails, -1 for none, or -2 for that of the first allocation which fails
+ */
+extern int fail_class;
+
+/*
+ * Number allocations from zero again, and take changes of the variables above
+ * into account. Each failed allocation is reported along with its number and
+ * size class, so that it can be failed again on purpose with fail_nth or
+ * fail_class.
+ */
+void fault_reset(void);
+
+/* Whether any allocation may fail under the schedule set above */
+bool fault_scheduled(void);
+
+/*
+ * Seed the random allocation failures, then call fault_reset(). The same
+ * seed makes the same allocations fail.
+ */
+void set_fault_seed(uintptr_t seed);
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
+ * Blocks served by magazines are left out, see set_magazine_mode().
  */
 void set_cautious_mode(bool cautious);
 
@@ -36,6 +65,24 @@ void set_cautious_mode(bool cautious);
  */
 void set_noallocate_mode(bool noallocate);
 
+/*
+ * Set/unset arena mode.
+ * In this mode, small blocks are carved out of large chunks and recycled
+ * through per-size free lists. Return false, leaving the mode unchanged, if
+ * any block is still allocated.
+ */
+bool set_arena_mode(bool arena);
+
+/*
+ * Set/unset magazine mode.
+ * In this mode, small blocks are allocated and freed through a cache private
+ * to each thread, which exchanges blocks with the arena in batches. Freeing
+ * such a block only checks its magic numbers, even in cautious mode, so that
+ * no lock is taken but once per batch. Return false, leaving the mode
+ * unchanged, if any block is still allocated.
+ */
+bool set_magazine_mode(bool magazine);
+
 /* Return whether any errors have occurred since last time checked */
 bool error_check();
 
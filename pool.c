@@ -0,0 +1,153 @@
+/* Thread pool used to run queue operations in parallel */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work; /* A new batch is available, or the pool stops */
+    pthread_cond_t done; /* A worker started, or finished a batch last */
+    pthread_t threads[POOL_MAX_THREADS - 1];
+    size_t nthreads;
+    size_t ready; /* Workers that have started up */
+    bool stop;
+
+    /* Current batch, published under the lock */
+    unsigned long generation;
+    size_t active; /* Workers with an id below this take part */
+    size_t running;
+    pool_task_t task;
+    void *arg;
+    size_t n;
+    atomic_size_t next; /* Next item to hand out */
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+/* Take items of the current batch until none is left */
+static void pool_drain(pool_task_t task, void *arg, size_t n)
+{
+    for (size_t i = atomic_fetch_add(&pool.next, 1); i < n;
+         i = atomic_fetch_add(&pool.next, 1))
+        task(arg, i);
+}
+
+static void *pool_worker(void *data)
+{
+    size_t id = (uintptr_t) data;
+
+    pthread_mutex_lock(&pool.lock);
+    unsigned long seen = pool.generation;
+    pool.ready++;
+    pthread_cond_broadcast(&pool.done);
+    for (;;) {
+        while (!pool.stop && pool.generation == seen)
+            pthread_cond_wait(&pool.work, &pool.lock);
+        if (pool.stop)
+            break;
+
+        seen = pool.generation;
+        if (id >= pool.active)
+            continue;
+
+        pool_task_t task = pool.task;
+        void *arg = pool.arg;
+        size_t n = pool.n;
+        pthread_mutex_unlock(&pool.lock);
+        pool_drain(task, arg, n);
+        pthread_mutex_lock(&pool.lock);
+
+        if (!--pool.running)
+            pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+/* Start workers until there are @want of them, as far as possible, and wait
+ * until all of them are ready, so none can miss the next batch.
+ * Workers run with every signal blocked, so that signals such as SIGALRM are
+ * always delivered to the main thread.
+ */
+static void pool_grow(size_t want)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (pool.nthreads < want) {
+        if (pthread_create(&pool.threads[pool.nthreads], NULL, pool_worker,
+                           (void *) (uintptr_t) pool.nthreads))
+            break;
+        pool.nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.ready < pool.nthreads)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void pool_run(int nthreads, pool_task_t task, void *arg, size_t n)
+{
+    if (nthreads > POOL_MAX_THREADS)
+        nthreads = POOL_MAX_THREADS;
+    size_t workers = nthreads > 1 ? nthreads - 1 : 0;
+    if (n && workers > n - 1)
+        workers = n - 1;
+    if (workers > pool.nthreads)
+        pool_grow(workers);
+    if (workers > pool.nthreads)
+        workers = pool.nthreads;
+
+    if (!workers) {
+        for (size_t i = 0; i < n; i++)
+            task(arg, i);
+        return;
+    }
+
+    sigset_t alrm, old;
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alrm, &old);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.task = task;
+    pool.arg = arg;
+    pool.n = n;
+    atomic_store(&pool.next, 0);
+    pool.active = workers;
+    pool.running = workers;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    pool_drain(task, arg, n);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.running)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void pool_destroy(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (size_t i = 0; i < pool.nthreads; i++)
+        pthread_join(pool.threads[i], NULL);
+    pool.nthreads = pool.ready = 0;
+    pool.stop = false;
+}
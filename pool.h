@@ -0,0 +1,29 @@
+#ifndef LAB0_POOL_H
+#define LAB0_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A small pool of worker threads for splitting queue operations.
+ * Workers are created on first use and kept around for later batches.
+ */
+
+/* Upper bound on the number of threads taking part in a batch */
+#define POOL_MAX_THREADS 64
+
+/* A task: handle item @i of the batch described by @arg */
+typedef void (*pool_task_t)(void *arg, size_t i);
+
+/*
+ * Run task(arg, i) for every i in [0, n) on at most @nthreads threads,
+ * including the calling one, and return once all of them are done.
+ * Items are handed out in no particular order. SIGALRM is held back for the
+ * duration of the batch, so a time limit expiring meanwhile fires only after
+ * the workers are idle again.
+ */
+void pool_run(int nthreads, pool_task_t task, void *arg, size_t n);
+
+/* Stop and join all workers */
+void pool_destroy(void);
+
+#endif /* LAB0_POOL_H */
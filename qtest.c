@@ -3,8 +3,13 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,8 +24,10 @@
 #include <time.h>
 #endif
 
+#include "dudect/cpucycles.h"
 #include "dudect/fixture.h"
 #include "list.h"
+#include "pool.h"
 #include "random.h"
 
 /* Shannon entropy */
@@ -45,6 +52,7 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "cqueue.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -53,7 +61,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -75,6 +82,28 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Seed of RAND strings and of the allocation failures, for replaying a run */
+static int seed = 0;
+
+/* RAND strings come from xoshiro256**, unless the OS random source is used */
+static int use_os_random = 0;
+static xoshiro256_t randstr_rng;
+
+static int use_arena = 0;
+static int use_magazine = 0;
+static int use_cautious = 1;
+
+/* Synchronization of the concurrent queue used by the mpmc command */
+static int cqueue_mode = CQ_LOCK_FREE;
+
+/* Counter read by cpucycles() to time simulation mode */
+static int cycle_counter = CPUCYCLES_SERIAL;
+
+/* Scratch space lent to q_sort() for sorting through an array */
+static int use_sort_array = 0;
+static q_sort_slot_t *sort_buffer = NULL;
+static size_t sort_buffer_len = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -101,9 +130,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -116,7 +142,6 @@ static bool do_free(int argc, char *argv[])
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -168,18 +193,125 @@ static bool do_new(int argc, char *argv[])
  */
 static void fill_rand_string(char *buf, size_t buf_size)
 {
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
-
-    uint64_t randstr_buf_64[MAX_RANDSTR_LEN] = {0};
-    randombytes((uint8_t *) randstr_buf_64, len * sizeof(uint64_t));
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[randstr_buf_64[n] % (sizeof(charset) - 1)];
+    size_t len = MIN_RANDSTR_LEN +
+                 xoshiro256_next(&randstr_rng) % (buf_size - MIN_RANDSTR_LEN);
+
+    if (use_os_random) {
+        uint64_t randstr_buf_64[MAX_RANDSTR_LEN] = {0};
+        randombytes((uint8_t *) randstr_buf_64, len * sizeof(uint64_t));
+        for (size_t n = 0; n < len; n++)
+            buf[n] = charset[randstr_buf_64[n] % (sizeof(charset) - 1)];
+    } else {
+        /* Four characters per draw, mapping 16 bits at a time onto the
+         * charset by multiplication rather than modulo
+         */
+        uint64_t r = 0;
+        for (size_t n = 0; n < len; n++, r >>= 16) {
+            if (!(n & 3))
+                r = xoshiro256_next(&randstr_rng);
+            buf[n] = charset[((r & 0xffff) * (sizeof(charset) - 1)) >> 16];
+        }
+    }
 
     buf[len] = '\0';
 }
 
+/* Validate the string stored by the @r-th insertion of @inserts */
+static bool check_insert(const char *cur_inserts,
+                         int r,
+                         const char *inserts,
+                         const char **lasts)
+{
+    if (!cur_inserts) {
+        report(1, "ERROR: Failed to save copy of string in queue");
+        return false;
+    }
+    if (r == 0 && inserts == cur_inserts) {
+        report(1,
+               "ERROR: Need to allocate and copy string for new "
+               "queue element");
+        return false;
+    }
+    if (r == 1 && *lasts == cur_inserts) {
+        report(1,
+               "ERROR: Need to allocate separate string for each "
+               "queue element");
+        return false;
+    }
+    *lasts = cur_inserts;
+    return true;
+}
+
+/* Insert all @reps strings with a single bulk call.
+ * Return the number of insertions done, which is either @reps or 0 if the
+ * batch could not be allocated; the caller then inserts one by one.
+ * Not to be used while allocations may fail on purpose, as the allocations of
+ * an abandoned batch would hide the failure and shift the numbers of those
+ * that follow.
+ */
+static int queue_insert_bulk(position_t pos,
+                             char *inserts,
+                             bool need_rand,
+                             int reps,
+                             bool *ok)
+{
+    char **strs = malloc(reps * sizeof(char *));
+    char *randstrs = need_rand ? malloc((size_t) reps * MAX_RANDSTR_LEN) : NULL;
+    if (!strs || (need_rand && !randstrs)) {
+        free(strs);
+        free(randstrs);
+        return 0;
+    }
+
+    for (int r = 0; r < reps; r++) {
+        if (need_rand) {
+            strs[r] = randstrs + (size_t) r * MAX_RANDSTR_LEN;
+            fill_rand_string(strs[r], MAX_RANDSTR_LEN);
+        } else {
+            strs[r] = inserts;
+        }
+    }
+
+    bool rval = pos == POS_TAIL ? q_insert_tail_bulk(current->q, strs, reps)
+                                : q_insert_head_bulk(current->q, strs, reps);
+    if (rval) {
+        current->size += reps;
+        /* Step back from the queue end to the element of the first insertion */
+        struct list_head *node =
+            pos == POS_TAIL ? current->q->prev : current->q->next;
+        for (int r = 1; r < reps; r++)
+            node = pos == POS_TAIL ? node->prev : node->next;
+
+        const char *lasts = NULL;
+        for (int r = 0; *ok && r < reps; r++) {
+            element_t *entry = list_entry(node, element_t, list);
+            *ok = check_insert(entry->value, r, strs[r], &lasts);
+            node = pos == POS_TAIL ? node->next : node->prev;
+        }
+        *ok = *ok && !error_check();
+    }
+
+    free(strs);
+    free(randstrs);
+    return rval ? reps : 0;
+}
+
+/* Report how the time of an operation grows with the length of the queue in
+ * simulation mode
+ */
+static bool queue_scaling(bool (*profile)(void), int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    if (!profile()) {
+        report(1, "ERROR: Wrong implementation, the queue length is off");
+        return false;
+    }
+    return true;
+}
+
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
@@ -199,7 +331,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         return ok;
     }
 
-    char *lasts = NULL;
+    const char *lasts = NULL;
     char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
     bool ok = true, need_rand = false;
@@ -227,7 +359,13 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     error_check();
 
     if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+        /* Under a fault schedule, allocations are numbered one insertion at a
+         * time, so that failures can be replayed with fail_nth
+         */
+        int r = reps > 1 && !fault_scheduled()
+                    ? queue_insert_bulk(pos, inserts, need_rand, reps, &ok)
+                    : 0;
+        for (; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
@@ -238,24 +376,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                     pos == POS_TAIL
                         ? list_last_entry(current->q, element_t, list)
                         : list_first_entry(current->q, element_t, list);
-                char *cur_inserts = entry->value;
-                if (!cur_inserts) {
-                    report(1, "ERROR: Failed to save copy of string in queue");
-                    ok = false;
-                } else if (r == 0 && inserts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate and copy string for new "
-                           "queue element");
-                    ok = false;
-                    break;
-                } else if (r == 1 && lasts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate separate string for each "
-                           "queue element");
-                    ok = false;
-                    break;
-                }
-                lasts = cur_inserts;
+                ok = check_insert(entry->value, r, inserts, &lasts);
             } else {
                 fail_count++;
                 if (fail_count < fail_limit)
@@ -439,6 +560,8 @@ static bool do_dedup(int argc, char *argv[])
             tmp = malloc(sizeof(element_t));
             if (!tmp)
                 break;
+            /* Also carry over the cached key, if any */
+            *tmp = *item;
             INIT_LIST_HEAD(&tmp->list);
             slen = strlen(item->value) + 1;
             tmp->value = malloc(slen);
@@ -483,14 +606,13 @@ static bool do_dedup(int argc, char *argv[])
         // Skip comparison with new list if the string is duplicate
         bool is_next_dup =
             item->list.next != &l_copy &&
-            strcmp(list_entry(item->list.next, element_t, list)->value,
-                   item->value) == 0;
+            q_element_cmp(list_entry(item->list.next, element_t, list),
+                          item) == 0;
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
         } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
+                   !q_element_cmp(list_entry(l_tmp, element_t, list), item))
             l_tmp = l_tmp->next;
         else
             ok = false;
@@ -514,6 +636,9 @@ static bool do_dedup(int argc, char *argv[])
 
 static bool do_reverse(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(profile_reverse, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -535,6 +660,9 @@ static bool do_reverse(int argc, char *argv[])
 
 static bool do_size(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(profile_size, argc, argv);
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
@@ -576,6 +704,72 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Make sure the sort buffer fits a queue of @n elements, as q_sort() may not
+ * allocate it by itself.
+ */
+static void reserve_sort_buffer(size_t n)
+{
+    if (sort_buffer_len >= 2 * n)
+        return;
+
+    free(sort_buffer);
+    sort_buffer_len = 2 * n;
+    sort_buffer = malloc(sort_buffer_len * sizeof(q_sort_slot_t));
+    if (!sort_buffer) {
+        report(1, "Warning: Cannot allocate a sort buffer of %zu slots",
+               sort_buffer_len);
+        sort_buffer_len = 0;
+    }
+    q_set_sort_buffer(sort_buffer, sort_buffer_len);
+}
+
+static void release_sort_buffer(void)
+{
+    q_set_sort_buffer(NULL, 0);
+    free(sort_buffer);
+    sort_buffer = NULL;
+    sort_buffer_len = 0;
+}
+
+/* A node and its position in the queue before sorting */
+typedef struct {
+    struct list_head *node;
+    size_t ordinal;
+} ordinal_t;
+
+static int cmp_node_addr(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) ((const ordinal_t *) a)->node;
+    uintptr_t y = (uintptr_t) ((const ordinal_t *) b)->node;
+    return (x > y) - (x < y);
+}
+
+/* Fill @ordinals with every node of @head and its position, ordered by node
+ * address so that positions can be looked up by ordinal_of().
+ */
+static void record_ordinals(struct list_head *head, ordinal_t *ordinals)
+{
+    size_t n = 0;
+    struct list_head *node;
+    list_for_each (node, head) {
+        ordinals[n].node = node;
+        ordinals[n].ordinal = n;
+        n++;
+    }
+    qsort(ordinals, n, sizeof(ordinal_t), cmp_node_addr);
+}
+
+/* Position of @node before sorting, or SIZE_MAX for a node never seen */
+static size_t ordinal_of(const ordinal_t *ordinals,
+                         size_t n,
+                         struct list_head *node)
+{
+    ordinal_t key = {.node = node};
+    const ordinal_t *o =
+        bsearch(&key, ordinals, n, sizeof(ordinal_t), cmp_node_addr);
+    return o ? o->ordinal : SIZE_MAX;
+}
+
 bool do_sort(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -594,24 +788,24 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
-    set_noallocate_mode(true);
+    if (use_sort_array)
+        reserve_sort_buffer(cnt);
 
-/* If the number of elements is too large, it may take a long time to check the
- * stability of the sort. So, MAX_NODES is used to limit the number of elements
- * to check the stability of the sort. */
-#define MAX_NODES 100000
-    struct list_head *nodes[MAX_NODES];
-    unsigned no = 0;
-    if (current && current->size && current->size <= MAX_NODES) {
-        element_t *entry;
-        list_for_each_entry (entry, current->q, list)
-            nodes[no++] = &entry->list;
-    } else if (current && current->size > MAX_NODES)
-        report(1,
-               "Warning: Skip checking the stability of the sort because the "
-               "number of elements %d is too large, exceeds the limit %d.",
-               current->size, MAX_NODES);
+    /* Remember where every node was, so the stability can be checked */
+    ordinal_t *ordinals = NULL;
+    if (current && cnt > 1) {
+        ordinals = malloc(cnt * sizeof(ordinal_t));
+        if (ordinals)
+            record_ordinals(current->q, ordinals);
+        else
+            report(1,
+                   "Warning: Skip checking the stability of the sort because "
+                   "%d ordinals cannot be allocated.",
+                   cnt);
+    }
+    int len = cnt;
 
+    set_noallocate_mode(true);
     if (current && exception_setup(true))
         q_sort(current->q, descend);
     exception_cancel();
@@ -625,43 +819,31 @@ bool do_sort(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && q_element_cmp(item, next_item) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
             }
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && q_element_cmp(item, next_item) < 0) {
                 report(1, "ERROR: Not sorted in descending order");
                 ok = false;
                 break;
             }
             /* Ensure the stability of the sort */
-            if (current->size <= MAX_NODES &&
-                !strcmp(item->value, next_item->value)) {
-                bool unstable = false;
-                for (unsigned i = 0; i < MAX_NODES; i++) {
-                    if (nodes[i] == cur_l->next) {
-                        unstable = true;
-                        break;
-                    }
-                    if (nodes[i] == cur_l) {
-                        break;
-                    }
-                }
-                if (unstable) {
-                    report(
-                        1,
-                        "ERROR: Not stable sort. The duplicate strings \"%s\" "
-                        "are not in the same order.",
-                        item->value);
-                    ok = false;
-                    break;
-                }
+            if (ordinals && !q_element_cmp(item, next_item) &&
+                ordinal_of(ordinals, len, cur_l) >
+                    ordinal_of(ordinals, len, cur_l->next)) {
+                report(1,
+                       "ERROR: Not stable sort. The duplicate strings \"%s\" "
+                       "are not in the same order.",
+                       item->value);
+                ok = false;
+                break;
             }
         }
     }
-#undef MAX_NODES
+    free(ordinals);
 
     q_show(3);
     return ok && !error_check();
@@ -669,6 +851,9 @@ bool do_sort(int argc, char *argv[])
 
 static bool do_dm(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(profile_delete_mid, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -695,6 +880,9 @@ static bool do_dm(int argc, char *argv[])
 
 static bool do_swap(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(profile_swap, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -752,7 +940,7 @@ static bool do_ascend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
+            if (q_element_cmp(item, next_item) > 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -799,7 +987,7 @@ static bool do_descend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
+            if (q_element_cmp(item, next_item) < 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -887,7 +1075,7 @@ static bool do_merge(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && q_element_cmp(item, next_item) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
                        "of unsorted queues are merged or there're some flaws "
@@ -897,7 +1085,7 @@ static bool do_merge(int argc, char *argv[])
             }
 
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && q_element_cmp(item, next_item) < 0) {
                 report(
                     1,
                     "ERROR: Not sorted in descending order (It might because "
@@ -1056,6 +1244,712 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Upper bound on the threads started by the mpmc command */
+#define MPMC_MAX_THREADS 128
+
+typedef struct {
+    cqueue_t *q;
+    int producers;
+    int ops;               /* Elements inserted by each producer */
+    atomic_long remaining; /* Elements neither removed nor failed to insert */
+    atomic_long removed;
+    atomic_bool disorder;  /* Elements of a producer came out of order */
+} mpmc_t;
+
+typedef struct {
+    mpmc_t *m;
+    int id;
+    pthread_t thread;
+} mpmc_worker_t;
+
+static void *mpmc_produce(void *data)
+{
+    mpmc_worker_t *w = data;
+    mpmc_t *m = w->m;
+    char buf[32];
+
+    for (int i = 0; i < m->ops; i++) {
+        snprintf(buf, sizeof(buf), "%d %d", w->id, i);
+        if (!cq_insert_tail(m->q, buf))
+            atomic_fetch_sub(&m->remaining, 1);
+    }
+    cq_thread_exit();
+    return NULL;
+}
+
+/* Remove elements until all of them are gone. Each producer inserted its
+ * elements in increasing order, so every consumer must see them that way.
+ */
+static void *mpmc_consume(void *data)
+{
+    mpmc_worker_t *w = data;
+    mpmc_t *m = w->m;
+    char buf[32];
+    long removed = 0;
+    int *last = malloc(sizeof(int) * m->producers);
+    if (!last) {
+        atomic_store(&m->disorder, true);
+        return NULL;
+    }
+    for (int i = 0; i < m->producers; i++)
+        last[i] = -1;
+
+    while (atomic_load(&m->remaining) > 0) {
+        if (!cq_remove_head(m->q, buf, sizeof(buf))) {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_sub(&m->remaining, 1);
+        removed++;
+
+        int id, seq;
+        if (sscanf(buf, "%d %d", &id, &seq) != 2 || id < 0 ||
+            id >= m->producers || seq <= last[id])
+            atomic_store(&m->disorder, true);
+        else
+            last[id] = seq;
+    }
+    free(last);
+    atomic_fetch_add(&m->removed, removed);
+    cq_thread_exit();
+    return NULL;
+}
+
+/* Start @n threads running @fn on @w, with every signal blocked like the
+ * workers of the pool. Return how many of them could be started.
+ */
+static int mpmc_start(mpmc_worker_t *w, int n, void *(*fn)(void *), mpmc_t *m)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int started = 0;
+    for (; started < n; started++) {
+        w[started].m = m;
+        w[started].id = started;
+        if (pthread_create(&w[started].thread, NULL, fn, &w[started]))
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return started;
+}
+
+static bool do_mpmc(int argc, char *argv[])
+{
+    if (argc > 4) {
+        report(1, "%s takes 0-3 arguments", argv[0]);
+        return false;
+    }
+
+    int producers = 4, consumers = 4, ops = 100000;
+    if ((argc > 1 && !get_int(argv[1], &producers)) ||
+        (argc > 2 && !get_int(argv[2], &consumers)) ||
+        (argc > 3 && !get_int(argv[3], &ops))) {
+        report(1, "Invalid arguments to %s", argv[0]);
+        return false;
+    }
+    if (producers < 1 || consumers < 1 || ops < 0 ||
+        producers + consumers > MPMC_MAX_THREADS) {
+        report(1,
+               "Need at least one producer and one consumer, and at most %d "
+               "threads",
+               MPMC_MAX_THREADS);
+        return false;
+    }
+
+    size_t allocated = allocation_check();
+    mpmc_t m = {.producers = producers, .ops = ops};
+    atomic_init(&m.remaining, (long) producers * ops);
+    atomic_init(&m.removed, 0);
+    atomic_init(&m.disorder, false);
+    m.q = cq_new(cqueue_mode);
+    if (!m.q) {
+        report(1, "ERROR: Could not allocate concurrent queue");
+        return false;
+    }
+
+    mpmc_worker_t w[MPMC_MAX_THREADS];
+    double time;
+    init_time(&time);
+    int np = mpmc_start(w, producers, mpmc_produce, &m);
+    int nc = mpmc_start(w + np, consumers, mpmc_consume, &m);
+    if (np < producers)
+        atomic_fetch_sub(&m.remaining, (long) (producers - np) * ops);
+    if (np < producers || nc < consumers)
+        report(1, "Warning: Started only %d producers and %d consumers", np,
+               nc);
+    /* Somebody has to empty the queue */
+    if (!nc)
+        mpmc_consume(&(mpmc_worker_t) {.m = &m, .id = 0});
+    for (int i = 0; i < np + nc; i++)
+        pthread_join(w[i].thread, NULL);
+    double elapsed = delta_time(&time);
+
+    bool ok = true;
+    if (atomic_load(&m.disorder)) {
+        report(1, "ERROR: Elements of a producer were removed out of order");
+        ok = false;
+    }
+    if (cq_remove_head(m.q, NULL, 0)) {
+        report(1, "ERROR: Queue not empty after all elements were removed");
+        ok = false;
+    }
+    cq_free(m.q);
+    cq_thread_exit();
+    if (allocation_check() != allocated) {
+        report(1, "ERROR: %lu blocks still allocated after freeing the queue",
+               allocation_check() - allocated);
+        ok = false;
+    }
+
+    long moved = atomic_load(&m.removed);
+    report(1, "%d producers, %d consumers: %ld elements in %.3f s (%.0f/s)",
+           np, nc, moved, elapsed, elapsed > 0 ? moved / elapsed : 0.0);
+    return ok && !error_check();
+}
+
+/* Each thread inserts an element and then removes one, n times over */
+static void *stress_worker(void *data)
+{
+    mpmc_worker_t *w = data;
+    mpmc_t *m = w->m;
+    char buf[32];
+    long done = 0;
+
+    snprintf(buf, sizeof(buf), "%d", w->id);
+    for (int i = 0; i < m->ops; i++) {
+        if (!cq_insert_tail(m->q, buf))
+            continue;
+        /* Never empty for long, this thread's element is in there */
+        while (!cq_remove_head(m->q, NULL, 0))
+            sched_yield();
+        done += 2;
+    }
+    atomic_fetch_add(&m->removed, done);
+    cq_thread_exit();
+    return NULL;
+}
+
+/* Run the stress test on a queue synchronized by @mode.
+ * Return the number of operations per second, or a negative value on failure.
+ */
+static double stress_run(cq_mode_t mode, int threads, int ops)
+{
+    mpmc_t m = {.ops = ops};
+    atomic_init(&m.removed, 0);
+    m.q = cq_new(mode);
+    if (!m.q)
+        return -1;
+
+    /* Keep producers and consumers at different ends of the queue */
+    bool ok = true;
+    for (int i = 0; ok && i < threads; i++)
+        ok = cq_insert_tail(m.q, "stress");
+
+    mpmc_worker_t w[MPMC_MAX_THREADS];
+    double time;
+    int started = 0;
+    if (ok) {
+        init_time(&time);
+        started = mpmc_start(w, threads, stress_worker, &m);
+        for (int i = 0; i < started; i++)
+            pthread_join(w[i].thread, NULL);
+    }
+    double elapsed = ok ? delta_time(&time) : 0;
+    cq_free(m.q);
+    cq_thread_exit();
+
+    if (started < threads)
+        return -1;
+    return elapsed > 0 ? atomic_load(&m.removed) / elapsed : 0;
+}
+
+static bool do_stress(int argc, char *argv[])
+{
+    if (argc > 3) {
+        report(1, "%s takes 0-2 arguments", argv[0]);
+        return false;
+    }
+
+    int threads = 4, ops = 100000;
+    if ((argc > 1 && !get_int(argv[1], &threads)) ||
+        (argc > 2 && !get_int(argv[2], &ops))) {
+        report(1, "Invalid arguments to %s", argv[0]);
+        return false;
+    }
+    if (threads < 1 || threads > MPMC_MAX_THREADS || ops < 0) {
+        report(1, "Number of threads must be between 1 and %d",
+               MPMC_MAX_THREADS);
+        return false;
+    }
+
+    static const char *names[] = {
+        [CQ_LOCK_FREE] = "lock-free",
+        [CQ_TWO_LOCK] = "two locks",
+        [CQ_ONE_LOCK] = "one mutex",
+    };
+    size_t allocated = allocation_check();
+    double rate[3];
+    bool ok = true;
+    for (cq_mode_t mode = CQ_LOCK_FREE; mode <= CQ_ONE_LOCK; mode++) {
+        rate[mode] = stress_run(mode, threads, ops);
+        if (rate[mode] < 0) {
+            report(1, "ERROR: Could not run %s queue with %d threads",
+                   names[mode], threads);
+            ok = false;
+            continue;
+        }
+        report(1, "%-9s: %.0f ops/s", names[mode], rate[mode]);
+    }
+    if (ok && rate[CQ_ONE_LOCK] > 0)
+        report(1, "Against one mutex: lock-free x%.2f, two locks x%.2f",
+               rate[CQ_LOCK_FREE] / rate[CQ_ONE_LOCK],
+               rate[CQ_TWO_LOCK] / rate[CQ_ONE_LOCK]);
+
+    if (allocation_check() != allocated) {
+        report(1, "ERROR: %lu blocks still allocated after freeing the queues",
+               allocation_check() - allocated);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+/* Queue sizes the complexity command times a command on, doubling from
+ * COMPLEXITY_MIN_SIZE, and the time of a run after which it stops growing
+ * them, so that even a quadratic command stays well within the time limit.
+ */
+#define COMPLEXITY_MIN_SIZE 256
+#define COMPLEXITY_MAX_SIZE (1 << 17)
+#define COMPLEXITY_BUDGET 0.1
+#define COMPLEXITY_REPS 5
+
+/* A command faster than this is run again and again within one timing, so
+ * that the time measured is some thousand times what reading the clock takes
+ */
+#define COMPLEXITY_MIN_TIME 50e-6
+
+/* Difference in AICc within which classes are reported together. Across the
+ * sizes timed, the curvature O(n log n) adds over O(n) is about as large as
+ * COMPLEXITY_MODEL_ERROR, so either can come out ahead by a few units. Beyond
+ * 10, a class has essentially no support from the timings.
+ */
+#define COMPLEXITY_TIE 10.0
+
+/* Relative error of the timings which no class is expected to fit better,
+ * from what the walks of the queue do not account for of the caches
+ */
+#define COMPLEXITY_MODEL_ERROR 0.1
+
+static double complexity_log(double n)
+{
+    return log2(n);
+}
+
+static double complexity_n(double n)
+{
+    return n;
+}
+
+static double complexity_nlogn(double n)
+{
+    return n * log2(n);
+}
+
+static double complexity_n2(double n)
+{
+    return n * n;
+}
+
+/* Every class is fitted as time = a + c * f(n), but for O(1) where f is NULL
+ * and time = a
+ */
+static const struct {
+    const char *name;
+    double (*f)(double n);
+} complexity_classes[] = {
+    {"O(1)", NULL},
+    {"O(log n)", complexity_log},
+    {"O(n)", complexity_n},
+    {"O(n log n)", complexity_nlogn},
+    {"O(n^2)", complexity_n2},
+};
+
+#define N_COMPLEXITY \
+    (sizeof(complexity_classes) / sizeof(complexity_classes[0]))
+
+/* Keeps the walks of complexity_run() from being optimized away */
+static volatile char complexity_sink;
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Time a command on a new queue of @size random strings, which is freed
+ * afterwards. A short command is run repeatedly until COMPLEXITY_MIN_TIME
+ * has passed, as long as the queue stays within a sixteenth of @size of its
+ * length. Return the time per call in seconds, or a negative value on
+ * failure, and in @visit the time a plain walk takes per element of the
+ * queue.
+ */
+static double complexity_run(int size, int argc, char *argv[], double *visit)
+{
+    char size_buf[16];
+    snprintf(size_buf, sizeof(size_buf), "%d", size);
+    char *new_argv[] = {"new"};
+    char *ih_argv[] = {"ih", "RAND", size_buf};
+    char *free_argv[] = {"free"};
+
+    queue_contex_t *saved = current;
+    double per_call = -1;
+    if (do_new(1, new_argv) && do_ih(3, ih_argv)) {
+        /* Time plain walks along the links of the queue */
+        int passes = 0;
+        int64_t start = cpucycles_clock(), elapsed;
+        do {
+            struct list_head *node;
+            list_for_each (node, current->q)
+                complexity_sink++;
+            passes++;
+            elapsed = cpucycles_clock() - start;
+        } while (elapsed < COMPLEXITY_MIN_TIME * 1e9);
+        *visit = elapsed * 1e-9 / passes / size;
+
+        int calls = 0;
+        bool ok = true;
+        start = cpucycles_clock();
+        do {
+            ok = interpret_cmda(argc, argv);
+            calls++;
+            elapsed = cpucycles_clock() - start;
+        } while (ok && elapsed < COMPLEXITY_MIN_TIME * 1e9 &&
+                 abs(current->size - size) <= size / 16);
+        if (ok)
+            per_call = elapsed * 1e-9 / calls;
+    }
+    if (current != saved)
+        do_free(1, free_argv);
+    current = saved;
+    return per_call;
+}
+
+/* Fit time = a + c * f(n) by least squares on the relative error, with a and
+ * c kept from going negative. Return the weighted sum of squared residuals,
+ * and in @growth how much c * f(n) adds over the sizes, relative to the
+ * longest time.
+ */
+static double complexity_fit_class(double (*f)(double n),
+                                   const int *sizes,
+                                   const double *times,
+                                   int points,
+                                   double *growth)
+{
+    double s = 0.0, sf = 0.0, sff = 0.0, sy = 0.0, sfy = 0.0;
+    for (int i = 0; i < points; i++) {
+        double w = 1 / (times[i] * times[i]);
+        double x = f ? f(sizes[i]) : 0.0;
+        s += w;
+        sf += w * x;
+        sff += w * x * x;
+        sy += w * times[i];
+        sfy += w * x * times[i];
+    }
+
+    double a = sy / s, c = 0.0;
+    if (f) {
+        c = (s * sfy - sf * sy) / (s * sff - sf * sf);
+        a = (sy - c * sf) / s;
+        if (c < 0) {
+            c = 0.0;
+            a = sy / s;
+        } else if (a < 0) {
+            a = 0.0;
+            c = sfy / sff;
+        }
+    }
+
+    double rss = 0.0, max_time = 0.0;
+    for (int i = 0; i < points; i++) {
+        double e = 1 - (a + c * (f ? f(sizes[i]) : 0.0)) / times[i];
+        rss += e * e;
+        max_time = fmax(max_time, times[i]);
+    }
+    *growth = f ? c * (f(sizes[points - 1]) - f(sizes[0])) / max_time : 0.0;
+    return rss;
+}
+
+/* Fit every complexity class and report the best ones, ranked by AICc, the
+ * Akaike criterion corrected for the few points there are. Residuals smaller
+ * than the spread of the repeated timings, @noise in relative variance, or
+ * than COMPLEXITY_MODEL_ERROR cannot tell classes apart, so none is taken to
+ * fit better than that. A class whose fitted growth is within that error is
+ * the same as O(1), and left out. Every class within COMPLEXITY_TIE of the
+ * best is reported along with it, slowest growing first. Return whether
+ * @expect, an index into complexity_classes or -1 for none, is among them.
+ */
+static bool complexity_fit(const int *sizes,
+                           const double *times,
+                           int points,
+                           double noise,
+                           int expect)
+{
+    double aic[N_COMPLEXITY];
+    size_t best = 0;
+    double floor =
+        fmax(noise, COMPLEXITY_MODEL_ERROR * COMPLEXITY_MODEL_ERROR);
+    for (size_t k = 0; k < N_COMPLEXITY; k++) {
+        double growth;
+        double rss = complexity_fit_class(complexity_classes[k].f, sizes,
+                                          times, points, &growth);
+        if (k && growth < sqrt(floor)) {
+            aic[k] = INFINITY;
+            continue;
+        }
+        rss = fmax(rss, points * floor);
+        int params = complexity_classes[k].f ? 2 : 1;
+        aic[k] = points * log(rss / points) + 2 * params +
+                 2.0 * params * (params + 1) / (points - params - 1);
+        if (aic[k] < aic[best])
+            best = k;
+    }
+
+    char fits[128];
+    int len = 0, tied = 0;
+    double total = 0.0;
+    bool found = expect < 0;
+    for (size_t k = 0; k < N_COMPLEXITY; k++) {
+        total += exp((aic[best] - aic[k]) / 2);
+        if (aic[k] - aic[best] > COMPLEXITY_TIE)
+            continue;
+        len += snprintf(fits + len, sizeof(fits) - len, "%s%s",
+                        tied++ ? " or " : "", complexity_classes[k].name);
+        found |= (int) k == expect;
+    }
+
+    if (tied == 1) {
+        report(1, "Best fit: %s, confidence %.1f%%",
+               complexity_classes[best].name, 100 / total);
+    } else {
+        report(1, "Best fits: %s, which the timings cannot tell apart",
+               fits);
+    }
+    return found;
+}
+
+/* Index of the class named @name in complexity_classes, where the spaces of
+ * the names may be left out, or -1
+ */
+static int complexity_class(const char *name)
+{
+    for (size_t k = 0; k < N_COMPLEXITY; k++) {
+        const char *c = complexity_classes[k].name, *n = name;
+        for (; *c; c++) {
+            if (*c != ' ' && *n++ != *c)
+                break;
+        }
+        if (!*c && !*n)
+            return k;
+    }
+    return -1;
+}
+
+/* Commands complexity may time, each working on the current queue alone.
+ * Those which create, free or switch queues, such as new, free, next or quit,
+ * would leave complexity_run() without the queue it made for them. They are
+ * refused with a message, like operations on a null queue, rather than
+ * counted as an error.
+ */
+static const char *complexity_commands[] = {
+    "ih",   "it", "rh",    "rt",   "reverse", "reverseK", "sort",
+    "size", "dm", "dedup", "swap", "ascend",  "descend",  NULL};
+
+static bool complexity_timeable(const char *cmd)
+{
+    for (const char **c = complexity_commands; *c; c++) {
+        if (!strcmp(cmd, *c))
+            return true;
+    }
+    return false;
+}
+
+static bool do_complexity(int argc, char *argv[])
+{
+    /* An optional class the command is expected to fit comes first */
+    int expect = -1;
+    if (argc > 1 && !strncmp(argv[1], "O(", 2)) {
+        expect = complexity_class(argv[1]);
+        if (expect < 0) {
+            report(1, "%s: unknown class '%s'", argv[0], argv[1]);
+            return false;
+        }
+    }
+    int cmd_argc = argc - (expect < 0 ? 1 : 2);
+    char **cmd_argv = argv + argc - cmd_argc;
+
+    if (cmd_argc < 1) {
+        report(1, "%s needs a command to time", argv[0]);
+        return false;
+    }
+    if (!complexity_timeable(cmd_argv[0])) {
+        report(1, "%s cannot time '%s', which does not work on one queue alone",
+               argv[0], cmd_argv[0]);
+        return true;
+    }
+
+    /* Keep the command quiet but for errors, so that only its work is timed */
+    int saved_verblevel = verblevel;
+    if (verblevel > 1)
+        set_verblevel(1);
+
+    int sizes[32], size = COMPLEXITY_MIN_SIZE;
+    double units[32], noise = 0.0;
+    int points = 0;
+
+    /* Warm up caches and branch predictors on a run which is not kept */
+    double visit[COMPLEXITY_REPS];
+    bool ok = complexity_run(size, cmd_argc, cmd_argv, visit) >= 0;
+    for (; ok && size <= COMPLEXITY_MAX_SIZE; size *= 2) {
+        double rep[COMPLEXITY_REPS];
+        for (int r = 0; ok && r < COMPLEXITY_REPS; r++) {
+            rep[r] = complexity_run(size, cmd_argc, cmd_argv, &visit[r]);
+            ok = rep[r] >= 0;
+        }
+        if (!ok)
+            break;
+
+        /* Keep the median, and as noise the relative variance of the runs,
+         * estimated from their median absolute deviation so that a run
+         * held up by the system does not count
+         */
+        qsort(rep, COMPLEXITY_REPS, sizeof(double), cmp_double);
+        double median = fmax(rep[COMPLEXITY_REPS / 2], 1e-9);
+        double dev[COMPLEXITY_REPS];
+        for (int r = 0; r < COMPLEXITY_REPS; r++)
+            dev[r] = fabs(rep[r] - median);
+        qsort(dev, COMPLEXITY_REPS, sizeof(double), cmp_double);
+        double sd = 1.4826 * dev[COMPLEXITY_REPS / 2] / median;
+        noise += sd * sd;
+
+        /* Count the time in walks of the same queue, so that the cost of
+         * each element going up as the queue outgrows a cache level does
+         * not pass for a faster growing class
+         */
+        qsort(visit, COMPLEXITY_REPS, sizeof(double), cmp_double);
+        sizes[points] = size;
+        units[points++] = median / fmax(visit[COMPLEXITY_REPS / 2], 1e-12);
+        report(1, "%8d elements: %.9f s", size, median);
+        if (median > COMPLEXITY_BUDGET)
+            break;
+    }
+    set_verblevel(saved_verblevel);
+
+    if (!ok) {
+        report(1, "ERROR: '%s' failed on a queue of %d elements", cmd_argv[0],
+               size);
+        return false;
+    }
+    if (points < 4) {
+        report(1, "ERROR: '%s' took too long to tell its complexity",
+               cmd_argv[0]);
+        return false;
+    }
+    /* The median of n runs varies about pi / 2n as much as a single run */
+    if (!complexity_fit(sizes, units, points,
+                        noise / points * 1.5708 / COMPLEXITY_REPS, expect)) {
+        report(1, "ERROR: '%s' does not fit %s", cmd_argv[0],
+               complexity_classes[expect].name);
+        return false;
+    }
+    return !error_check();
+}
+
+static void fault_changed(int oldval)
+{
+    fault_reset();
+}
+
+static void seed_changed(int oldval)
+{
+    xoshiro256_seed(&randstr_rng, seed);
+    set_fault_seed(seed);
+}
+
+static void arena_changed(int oldval)
+{
+    if (set_arena_mode(use_arena))
+        return;
+
+    report(1, "Cannot switch allocator while %lu blocks are allocated",
+           allocation_check());
+    use_arena = oldval;
+}
+
+static void magazine_changed(int oldval)
+{
+    if (set_magazine_mode(use_magazine))
+        return;
+
+    report(1, "Cannot switch allocator while %lu blocks are allocated",
+           allocation_check());
+    use_magazine = oldval;
+}
+
+static void cautious_changed(int oldval)
+{
+    set_cautious_mode(use_cautious);
+}
+
+/* Revert @threads to @oldval unless it is a valid thread count */
+static void check_threads(int *threads, int oldval)
+{
+    if (*threads >= 1 && *threads <= POOL_MAX_THREADS)
+        return;
+
+    report(1, "Number of threads must be between 1 and %d", POOL_MAX_THREADS);
+    *threads = oldval;
+}
+
+static void merge_threads_changed(int oldval)
+{
+    check_threads(&q_merge_threads, oldval);
+}
+
+static void sort_threads_changed(int oldval)
+{
+    check_threads(&q_sort_threads, oldval);
+}
+
+static void dudect_threads_changed(int oldval)
+{
+    check_threads(&dudect_threads, oldval);
+}
+
+static void cqueue_mode_changed(int oldval)
+{
+    if (cqueue_mode >= CQ_LOCK_FREE && cqueue_mode <= CQ_ONE_LOCK)
+        return;
+
+    report(1, "Concurrent queue mode must be between %d and %d", CQ_LOCK_FREE,
+           CQ_ONE_LOCK);
+    cqueue_mode = oldval;
+}
+
+static void cycle_counter_changed(int oldval)
+{
+    if (cpucycles_select(cycle_counter))
+        return;
+
+    report(1, "Cycle counter %d is unknown or cannot be read", cycle_counter);
+    cycle_counter = oldval;
+}
+
+static void sort_array_changed(int oldval)
+{
+    if (!use_sort_array)
+        release_sort_buffer();
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1094,16 +1988,78 @@ static void console_init()
                 "Remove every node which has a node with a strictly greater "
                 "value anywhere to the right side of it",
                 "");
+    ADD_COMMAND(mpmc,
+                "Move n elements per producer through a concurrent queue "
+                "(default: 4 4 100000)",
+                "[producers] [consumers] [n]");
+    ADD_COMMAND(stress,
+                "Insert and remove n elements per thread in each concurrent "
+                "queue mode (default: 4 100000)",
+                "[threads] [n]");
+    ADD_COMMAND(complexity,
+                "Fit the complexity of a command from its time on queues of "
+                "growing size, failing unless the class given, such as "
+                "O(nlogn), is among the best fits",
+                "[class] cmd arg ...");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
+              fault_changed);
+    add_param("fail_nth", &fail_nth,
+              "Number of the allocation to fail after the last change of "
+              "the failure options (0: none)",
+              fault_changed);
+    add_param("fail_class", &fail_class,
+              "Size class in which every allocation fails (-1: none, -2: that "
+              "of the first failure)",
+              fault_changed);
+    add_param("seed", &seed, "Seed of RAND strings and of malloc failures",
+              seed_changed);
+    add_param("rand_os", &use_os_random,
+              "Draw the characters of RAND strings from the OS random source",
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("arena", &use_arena,
+              "Allocate small blocks from a size-class slab arena",
+              arena_changed);
+    add_param("magazine", &use_magazine,
+              "Cache small blocks in per-thread magazines, whose frees only "
+              "check magic numbers, even in cautious mode",
+              magazine_changed);
+    add_param("cautious", &use_cautious,
+              "Check that every block freed is allocated, but for blocks from "
+              "magazines",
+              cautious_changed);
+    add_param("merge_threads", &q_merge_threads,
+              "Number of threads merging queues in parallel",
+              merge_threads_changed);
+    add_param("sort_threads", &q_sort_threads,
+              "Number of threads sorting long queues in parallel",
+              sort_threads_changed);
+    add_param("dudect_threads", &dudect_threads,
+              "Number of threads, pinned to distinct CPUs, measuring in "
+              "simulation mode",
+              dudect_threads_changed);
+    add_param("cycles", &cycle_counter,
+              "Counter timing simulation mode: 0 fenced TSC, 1 bare TSC, 2 "
+              "perf_event cycles, 3 CLOCK_MONOTONIC_RAW",
+              cycle_counter_changed);
+    add_param("sort_radix", &q_sort_radix,
+              "Sort by MSD radix sort on the bytes of the strings", NULL);
+    add_param("sort_gallop", &q_sort_gallop,
+              "Gallop through blocks of one run when merging in q_sort", NULL);
+    add_param("sort_array", &use_sort_array,
+              "Sort through an array of node pointers and string prefixes",
+              sort_array_changed);
+    add_param("cqueue_mode", &cqueue_mode,
+              "Concurrent queue of mpmc: 0 lock-free, 1 two locks, 2 one "
+              "mutex",
+              cqueue_mode_changed);
 }
 
 /* Signal handlers */
@@ -1136,8 +2092,6 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
@@ -1151,7 +2105,8 @@ static bool q_quit(int argc, char *argv[])
     }
 
     exception_cancel();
-    set_cautious_mode(true);
+    pool_destroy();
+    release_sort_buffer();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1160,6 +2115,9 @@ static bool q_quit(int argc, char *argv[])
         return false;
     }
 
+    /* Release the chunks held by the arena, if any */
+    set_magazine_mode(false);
+    set_arena_mode(false);
     return true;
 }
 
@@ -1417,7 +2375,9 @@ int main(int argc, char *argv[])
     /* A better seed can be obtained by combining getpid() and its parent ID
      * with the Unix time.
      */
-    srand(os_random(getpid() ^ getppid()));
+    seed = os_random(getpid() ^ getppid()) & INT_MAX;
+    xoshiro256_seed(&randstr_rng, seed);
+    set_fault_seed(seed);
 
     q_init();
     init_cmd();
@@ -1,52 +1,205 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "pool.h"
 #include "queue.h"
 
+/* Compare two nodes in the requested order.
+ * A negative value means @a shall be placed before @b.
+ */
+static inline int q_cmp(const struct list_head *a,
+                        const struct list_head *b,
+                        bool descend)
+{
+    int r = q_element_cmp(list_entry(a, element_t, list),
+                          list_entry(b, element_t, list));
+    return descend ? -r : r;
+}
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    return NULL;
+    struct list_head *head = malloc(sizeof(struct list_head));
+    if (!head)
+        return NULL;
+
+    INIT_LIST_HEAD(head);
+    return head;
 }
 
 /* Free all storage used by queue */
-void q_free(struct list_head *head) {}
+void q_free(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    element_t *entry, *safe;
+    list_for_each_entry_safe (entry, safe, head, list)
+        q_release_element(entry);
+    free(head);
+}
+
+/* Allocate a new element holding a copy of @s.
+ * The string is stored right after the list node, so a single allocation is
+ * needed and walking the queue touches fewer cache lines.
+ */
+static element_t *q_new_element(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    element_t *e = malloc(sizeof(element_t) + len);
+    if (!e)
+        return NULL;
+
+    e->value = memcpy(e->data, s, len);
+#ifdef Q_PREFIX_KEY
+    e->key = q_prefix_key(s);
+#endif
+    return e;
+}
 
 /* Insert an element at head of queue */
 bool q_insert_head(struct list_head *head, char *s)
 {
+    if (!head || !s)
+        return false;
+
+    element_t *e = q_new_element(s);
+    if (!e)
+        return false;
+
+    list_add(&e->list, head);
     return true;
 }
 
 /* Insert an element at tail of queue */
 bool q_insert_tail(struct list_head *head, char *s)
 {
+    if (!head || !s)
+        return false;
+
+    element_t *e = q_new_element(s);
+    if (!e)
+        return false;
+
+    list_add_tail(&e->list, head);
+    return true;
+}
+
+/* Build the elements for @s[0..n-1] on the empty private list @list, either
+ * in array order or, for @reverse, as repeated head insertions leave them.
+ * Nothing is kept if any allocation fails.
+ */
+static bool q_new_elements(struct list_head *list,
+                           char **s,
+                           size_t n,
+                           bool reverse)
+{
+    for (size_t i = 0; i < n; i++) {
+        element_t *e = s[i] ? q_new_element(s[i]) : NULL;
+        if (!e) {
+            element_t *entry, *safe;
+            list_for_each_entry_safe (entry, safe, list, list)
+                q_release_element(entry);
+            return false;
+        }
+        if (reverse)
+            list_add(&e->list, list);
+        else
+            list_add_tail(&e->list, list);
+    }
+    return true;
+}
+
+/* Insert @n elements at head of queue, all or nothing */
+bool q_insert_head_bulk(struct list_head *head, char **s, size_t n)
+{
+    if (!head || (!s && n))
+        return false;
+
+    LIST_HEAD(list);
+    if (!q_new_elements(&list, s, n, true))
+        return false;
+
+    list_splice(&list, head);
     return true;
 }
 
+/* Insert @n elements at tail of queue, all or nothing */
+bool q_insert_tail_bulk(struct list_head *head, char **s, size_t n)
+{
+    if (!head || (!s && n))
+        return false;
+
+    LIST_HEAD(list);
+    if (!q_new_elements(&list, s, n, false))
+        return false;
+
+    list_splice_tail(&list, head);
+    return true;
+}
+
+/* Unlink @node and copy its string into @sp */
+static element_t *q_remove(struct list_head *node, char *sp, size_t bufsize)
+{
+    element_t *e = list_entry(node, element_t, list);
+    list_del(node);
+
+    if (sp && bufsize) {
+        strncpy(sp, e->value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+    return e;
+}
+
 /* Remove an element from head of queue */
 element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
 {
-    return NULL;
+    if (!head || list_empty(head))
+        return NULL;
+
+    return q_remove(head->next, sp, bufsize);
 }
 
 /* Remove an element from tail of queue */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
 {
-    return NULL;
+    if (!head || list_empty(head))
+        return NULL;
+
+    return q_remove(head->prev, sp, bufsize);
 }
 
 /* Return number of elements in queue */
 int q_size(struct list_head *head)
 {
-    return -1;
+    if (!head)
+        return 0;
+
+    int len = 0;
+    struct list_head *node;
+    list_for_each (node, head)
+        len++;
+    return len;
 }
 
 /* Delete the middle node in queue */
 bool q_delete_mid(struct list_head *head)
 {
     // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
+    if (!head || list_empty(head))
+        return false;
+
+    /* Walk from both ends until the two cursors meet */
+    struct list_head *fwd = head->next, *bwd = head->prev;
+    while (fwd != bwd && fwd->next != bwd) {
+        fwd = fwd->next;
+        bwd = bwd->prev;
+    }
+
+    list_del(bwd);
+    q_release_element(list_entry(bwd, element_t, list));
     return true;
 }
 
@@ -54,6 +207,26 @@ bool q_delete_mid(struct list_head *head)
 bool q_delete_dup(struct list_head *head)
 {
     // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
+    if (!head)
+        return false;
+
+    struct list_head *node = head->next;
+    while (node != head) {
+        struct list_head *next = node->next;
+        bool dup = false;
+        while (next != head && !q_cmp(node, next, false)) {
+            struct list_head *victim = next;
+            next = next->next;
+            list_del(victim);
+            q_release_element(list_entry(victim, element_t, list));
+            dup = true;
+        }
+        if (dup) {
+            list_del(node);
+            q_release_element(list_entry(node, element_t, list));
+        }
+        node = next;
+    }
     return true;
 }
 
@@ -61,26 +234,879 @@ bool q_delete_dup(struct list_head *head)
 void q_swap(struct list_head *head)
 {
     // https://leetcode.com/problems/swap-nodes-in-pairs/
+    q_reverseK(head, 2);
 }
 
 /* Reverse elements in queue */
-void q_reverse(struct list_head *head) {}
+void q_reverse(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return;
+
+    struct list_head *node = head;
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != head);
+}
 
 /* Reverse the nodes of the list k at a time */
 void q_reverseK(struct list_head *head, int k)
 {
     // https://leetcode.com/problems/reverse-nodes-in-k-group/
+    if (!head || list_empty(head) || k < 2)
+        return;
+
+    LIST_HEAD(group);
+    struct list_head *node, *safe, *anchor = head;
+    int cnt = 0;
+    list_for_each_safe (node, safe, head) {
+        if (++cnt < k)
+            continue;
+        list_cut_position(&group, anchor, node);
+        q_reverse(&group);
+        list_splice_init(&group, anchor);
+        anchor = safe->prev;
+        cnt = 0;
+    }
+}
+
+/* Natural merge sort
+ *
+ * The list is consumed from left to right as a sequence of maximal runs: a
+ * non-descending run is taken as is, while a strictly descending run is
+ * reversed in place, which keeps the sort stable. Runs are pushed onto a
+ * fixed-size stack and merged bottom-up following the invariants of Timsort:
+ *
+ *     len[i - 2] > len[i - 1] + len[i]
+ *     len[i - 1] > len[i]
+ *
+ * so merges stay balanced and the run lengths on the stack grow at least as
+ * fast as the Fibonacci numbers. Already ordered input forms a single run and
+ * is sorted with n - 1 comparisons. Neither recursion nor allocation is used.
+ *
+ * While sorting, a run is a NULL-terminated list chained via 'next', whose
+ * 'prev' links are kept valid except the one of its first node.
+ */
+
+/* Enough for 2^64 nodes since run lengths grow like Fibonacci numbers */
+#define MAX_PENDING_RUNS 85
+
+/* Consecutive wins of one run before a merge switches to galloping */
+#define MIN_GALLOP 7
+
+int q_sort_gallop = 1;
+
+struct run {
+    struct list_head *head, *tail;
+    size_t len;
+};
+
+struct merge_state {
+    bool descend;
+    /* Adaptive galloping threshold, carried across merges like Timsort */
+    int min_gallop;
+};
+
+/* Link the already chained nodes from @first to @last after @tail */
+static inline struct list_head *append(struct list_head *tail,
+                                       struct list_head *first,
+                                       struct list_head *last)
+{
+    tail->next = first;
+    first->prev = tail;
+    return last;
+}
+
+/* Count the leading nodes of @list that compare less than @bound against
+ * @key, i.e. that go before @key when @bound is 1 and strictly before it when
+ * @bound is 0. The last of them is stored in @last.
+ *
+ * Probes are taken at offsets 0, 2, 6, 14, ... with gaps growing up to
+ * GALLOP_SPAN nodes, so a block of k nodes costs about k / GALLOP_SPAN
+ * comparisons. Every node is visited once: the nodes of the current gap are
+ * kept in an array, where the binary search for the boundary runs instead of
+ * walking the list again.
+ */
+#define GALLOP_SPAN 64
+
+static size_t gallop(struct list_head *list,
+                     const struct list_head *key,
+                     bool descend,
+                     int bound,
+                     struct list_head **last)
+{
+    struct list_head *gap[GALLOP_SPAN], *good = NULL, *node = list;
+    size_t n = 0, step = 1;
+
+    for (;;) {
+        size_t k = 0;
+        while (k < step && node) {
+            gap[k++] = node;
+            node = node->next;
+        }
+        if (!k)
+            break;
+        if (q_cmp(gap[k - 1], key, descend) < bound) {
+            good = gap[k - 1];
+            n += k;
+            if (step < GALLOP_SPAN)
+                step <<= 1;
+            continue;
+        }
+
+        /* The boundary lies within the gap, whose last node fails */
+        size_t lo = 0, hi = k - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) >> 1;
+            if (q_cmp(gap[mid], key, descend) < bound)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo) {
+            good = gap[lo - 1];
+            n += lo;
+        }
+        break;
+    }
+
+    *last = good;
+    return n;
+}
+
+/* Merge run @b into the run @a preceding it, taking from @a on ties.
+ *
+ * Nodes are compared one pair at a time until one run wins 'min_gallop'
+ * times in a row. The merge then gallops, moving whole blocks at once, and
+ * stays in that mode while blocks of at least MIN_GALLOP nodes are found.
+ * Like Timsort, 'min_gallop' shrinks while galloping pays off and grows
+ * whenever it does not, so random data keeps the plain merge loop.
+ */
+static void merge_runs(struct run *a,
+                       const struct run *b,
+                       struct merge_state *ms)
+{
+    struct list_head dummy, *tail = &dummy, *last;
+    struct list_head *x = a->head, *y = b->head;
+    int min_gallop = ms->min_gallop;
+    int wins_x = 0, wins_y = 0;
+
+    for (;;) {
+        if (q_cmp(x, y, ms->descend) <= 0) {
+            tail = append(tail, x, x);
+            x = x->next;
+            if (!x)
+                goto y_rest;
+            wins_x++;
+            wins_y = 0;
+        } else {
+            tail = append(tail, y, y);
+            y = y->next;
+            if (!y)
+                goto x_rest;
+            wins_y++;
+            wins_x = 0;
+        }
+        if (wins_x < min_gallop && wins_y < min_gallop)
+            continue;
+
+        size_t nx, ny;
+        min_gallop++;
+        do {
+            min_gallop -= min_gallop > 1;
+
+            nx = gallop(x, y, ms->descend, 1, &last);
+            if (nx) {
+                tail = append(tail, x, last);
+                x = last->next;
+                if (!x)
+                    goto y_rest;
+            }
+            /* Now @y goes strictly before @x */
+            tail = append(tail, y, y);
+            y = y->next;
+            if (!y)
+                goto x_rest;
+
+            ny = gallop(y, x, ms->descend, 0, &last);
+            if (ny) {
+                tail = append(tail, y, last);
+                y = last->next;
+                if (!y)
+                    goto x_rest;
+            }
+            /* Now @x goes before @y */
+            tail = append(tail, x, x);
+            x = x->next;
+            if (!x)
+                goto y_rest;
+        } while (nx >= MIN_GALLOP || ny >= MIN_GALLOP);
+        /* Penalize leaving the galloping mode */
+        min_gallop++;
+        wins_x = wins_y = 0;
+    }
+
+x_rest:
+    append(tail, x, a->tail);
+    goto out;
+y_rest:
+    a->tail = append(tail, y, b->tail);
+out:
+    a->head = dummy.next;
+    a->len += b->len;
+    ms->min_gallop = min_gallop;
+}
+
+/* Detach the maximal run at the front of @list, which must not be empty.
+ * Return the remaining nodes, and store the run in @r.
+ */
+static struct list_head *take_run(struct list_head *list,
+                                  struct run *r,
+                                  bool descend)
+{
+    struct list_head *head = list, *next = list->next;
+    size_t len = 1;
+
+    if (next && q_cmp(head, next, descend) > 0) {
+        /* Strictly descending run, reverse it while scanning */
+        head->next = NULL;
+        do {
+            struct list_head *tmp = next->next;
+            next->next = head;
+            head->prev = next;
+            head = next;
+            next = tmp;
+            len++;
+        } while (next && q_cmp(head, next, descend) > 0);
+        r->tail = list;
+    } else {
+        struct list_head *tail = head;
+        while (next && q_cmp(tail, next, descend) <= 0) {
+            next->prev = tail;
+            tail = next;
+            next = next->next;
+            len++;
+        }
+        tail->next = NULL;
+        r->tail = tail;
+    }
+
+    r->head = head;
+    r->len = len;
+    return next;
+}
+
+/* Merge the runs at @i and @i + 1 on the stack */
+static void merge_at(struct run *runs, int *n, int i, struct merge_state *ms)
+{
+    merge_runs(&runs[i], &runs[i + 1], ms);
+    if (i + 2 < *n)
+        runs[i + 1] = runs[i + 2];
+    (*n)--;
+}
+
+/* Restore the stack invariants after a new run is pushed */
+static void merge_collapse(struct run *runs, int *n, struct merge_state *ms)
+{
+    while (*n > 1) {
+        int i = *n - 2;
+        if ((i > 0 && runs[i - 1].len <= runs[i].len + runs[i + 1].len) ||
+            (i > 1 && runs[i - 2].len <= runs[i - 1].len + runs[i].len)) {
+            if (runs[i - 1].len < runs[i + 1].len)
+                i--;
+        } else if (runs[i].len > runs[i + 1].len) {
+            break;
+        }
+        merge_at(runs, n, i, ms);
+    }
+}
+
+/* Close the circle formed by @head and the nodes of @r */
+static inline void link_run(struct list_head *head, const struct run *r)
+{
+    head->next = r->head;
+    r->head->prev = head;
+    r->tail->next = head;
+    head->prev = r->tail;
+}
+
+/* Loser tree
+ *
+ * Merging k queues one after another into the first costs O(N k), as the
+ * first queue is walked again by every merge. Instead, up to MERGE_WAYS queues
+ * are merged at once through a tournament tree whose leaves are the heads of
+ * the queues. Every internal node remembers the loser of the match played
+ * there and the overall winner sits on top, so after a node is taken from the
+ * winning queue only the matches on the path from its leaf to the root are
+ * replayed: ceil(log2 k) comparisons per node, against about twice as many
+ * for a binary heap. Ties go to the queue placed earlier in the chain, which
+ * keeps the merge stable. Everything lives on the stack, as neither q_sort()
+ * nor q_merge() may allocate.
+ */
+#define MERGE_WAYS 64
+
+struct loser_tree {
+    bool descend;
+    int k;
+    int live;                              /* Lists not yet drained */
+    struct list_head *cur[MERGE_WAYS];     /* NULL once drained */
+    struct list_head *last[MERGE_WAYS];
+    int node[MERGE_WAYS];                  /* node[0] is the winner */
+};
+
+/* Whether the next node of list @a goes out before that of list @b */
+static inline bool lt_before(const struct loser_tree *lt, int a, int b)
+{
+    if (!lt->cur[a] || !lt->cur[b])
+        return !lt->cur[b];
+    int r = q_cmp(lt->cur[a], lt->cur[b], lt->descend);
+    return r < 0 || (!r && a < b);
+}
+
+/* Leaves are numbered k to 2k - 1, internal nodes 1 to k - 1 */
+static void lt_init(struct loser_tree *lt)
+{
+    int win[2 * MERGE_WAYS];
+    for (int i = 0; i < lt->k; i++)
+        win[lt->k + i] = i;
+    for (int p = lt->k - 1; p > 0; p--) {
+        int a = win[2 * p], b = win[2 * p + 1];
+        bool a_wins = lt_before(lt, a, b);
+        win[p] = a_wins ? a : b;
+        lt->node[p] = a_wins ? b : a;
+    }
+    lt->node[0] = win[1];
+}
+
+/* Replay the matches of list @w, whose head just changed */
+static inline void lt_replay(struct loser_tree *lt, int w)
+{
+    for (int p = (lt->k + w) / 2; p > 0; p /= 2) {
+        if (lt_before(lt, lt->node[p], w)) {
+            int t = lt->node[p];
+            lt->node[p] = w;
+            w = t;
+        }
+    }
+    lt->node[0] = w;
+}
+
+/* Merge the NULL-terminated lists set up in @lt->cur and @lt->last, appending
+ * their nodes after @tail. Return the last node appended.
+ */
+static struct list_head *lt_merge(struct loser_tree *lt, struct list_head *tail)
+{
+    lt->live = 0;
+    for (int i = 0; i < lt->k; i++)
+        lt->live += !!lt->cur[i];
+    lt_init(lt);
+
+    while (lt->live > 1) {
+        int w = lt->node[0];
+        struct list_head *node = lt->cur[w];
+        tail->next = node;
+        node->prev = tail;
+        tail = node;
+        if (!(lt->cur[w] = node->next))
+            lt->live--;
+        lt_replay(lt, w);
+    }
+
+    /* The winner is the only list left, if any: link what remains of it */
+    if (lt->live) {
+        int w = lt->node[0];
+        tail->next = lt->cur[w];
+        lt->cur[w]->prev = tail;
+        tail = lt->last[w];
+    }
+    return tail;
+}
+
+/* Sort the non-empty queue at @head on the calling thread */
+static void sort_list(struct list_head *head, bool descend)
+{
+    struct merge_state ms = {
+        .descend = descend,
+        .min_gallop = q_sort_gallop ? MIN_GALLOP : INT_MAX,
+    };
+    struct run runs[MAX_PENDING_RUNS];
+    int n = 0;
+
+    /* Break the circle so the last node is NULL-terminated */
+    struct list_head *list = head->next;
+    head->prev->next = NULL;
+
+    while (list) {
+        list = take_run(list, &runs[n++], descend);
+        merge_collapse(runs, &n, &ms);
+    }
+
+    /* Merge whatever is left, smaller neighbors first */
+    while (n > 1) {
+        int i = n - 2;
+        if (i > 0 && runs[i - 1].len < runs[i + 1].len)
+            i--;
+        merge_at(runs, &n, i, &ms);
+    }
+
+    link_run(head, &runs[0]);
+}
+
+int q_sort_threads = 1;
+
+/* Parallel sort
+ *
+ * The queue is cut into one contiguous segment per thread, and the segments
+ * are sorted concurrently. A few evenly spaced nodes of every sorted segment
+ * are collected and sorted, and from them splitters are chosen which divide
+ * the range of values into as many buckets as there are segments. Every
+ * segment is then cut, again concurrently, at the splitters, and bucket b is
+ * produced by merging the b-th piece of every segment through a loser tree,
+ * all buckets at the same time. Concatenating the buckets gives the result.
+ *
+ * Nodes comparing equal always fall into the same bucket, and within a bucket
+ * ties go to the piece of the earlier segment, so the sort stays stable.
+ */
+#define PARALLEL_SORT_MIN (1 << 15)
+#define SORT_MAX_PARTS 32
+#define SORT_OVERSAMPLE 8
+
+struct parallel_sort {
+    bool descend;
+    int parts;
+    struct list_head seg[SORT_MAX_PARTS];
+    size_t len[SORT_MAX_PARTS];
+    struct list_head *sample[SORT_MAX_PARTS * SORT_OVERSAMPLE];
+    struct list_head *splitter[SORT_MAX_PARTS - 1];
+    struct run piece[SORT_MAX_PARTS][SORT_MAX_PARTS]; /* [bucket][segment] */
+    struct run bucket[SORT_MAX_PARTS];
+};
+
+/* Sort segment @i and pick its samples */
+static void sort_segment(void *arg, size_t i)
+{
+    struct parallel_sort *ps = arg;
+    sort_list(&ps->seg[i], ps->descend);
+
+    struct list_head *node = ps->seg[i].next;
+    size_t pos = 0;
+    for (int j = 0; j < SORT_OVERSAMPLE; j++) {
+        size_t target = (j + 1) * ps->len[i] / (SORT_OVERSAMPLE + 1);
+        for (; pos < target; pos++)
+            node = node->next;
+        ps->sample[i * SORT_OVERSAMPLE + j] = node;
+    }
+}
+
+/* Cut sorted segment @i into NULL-terminated pieces, one per bucket.
+ * A node goes to the first bucket whose splitter it does not exceed.
+ */
+static void cut_segment(void *arg, size_t i)
+{
+    struct parallel_sort *ps = arg;
+    struct list_head *node = ps->seg[i].next;
+    ps->seg[i].prev->next = NULL;
+
+    for (int b = 0; b < ps->parts; b++)
+        ps->piece[b][i].head = NULL;
+    for (int b = 0; node; node = node->next) {
+        while (b < ps->parts - 1 &&
+               q_cmp(node, ps->splitter[b], ps->descend) > 0)
+            b++;
+        struct run *r = &ps->piece[b][i];
+        if (!r->head)
+            r->head = node;
+        r->tail = node;
+    }
+    for (int b = 0; b < ps->parts; b++) {
+        if (ps->piece[b][i].head)
+            ps->piece[b][i].tail->next = NULL;
+    }
+}
+
+/* Merge the pieces of bucket @b */
+static void merge_bucket(void *arg, size_t b)
+{
+    struct parallel_sort *ps = arg;
+    struct loser_tree lt = {.descend = ps->descend, .k = ps->parts};
+    for (int i = 0; i < ps->parts; i++) {
+        lt.cur[i] = ps->piece[b][i].head;
+        lt.last[i] = ps->piece[b][i].tail;
+    }
+
+    struct list_head first;
+    struct list_head *tail = lt_merge(&lt, &first);
+    ps->bucket[b].head = tail == &first ? NULL : first.next;
+    ps->bucket[b].tail = tail;
+}
+
+static void sort_parallel(struct list_head *head, size_t len, bool descend)
+{
+    struct parallel_sort ps = {.descend = descend};
+    ps.parts = q_sort_threads < SORT_MAX_PARTS ? q_sort_threads
+                                               : SORT_MAX_PARTS;
+
+    for (int i = 0; i < ps.parts; i++) {
+        ps.len[i] = len / ps.parts + ((size_t) i < len % ps.parts);
+        INIT_LIST_HEAD(&ps.seg[i]);
+        if (i == ps.parts - 1) {
+            list_splice_init(head, &ps.seg[i]);
+            break;
+        }
+        struct list_head *node = head;
+        for (size_t n = 0; n < ps.len[i]; n++)
+            node = node->next;
+        list_cut_position(&ps.seg[i], head, node);
+    }
+    pool_run(q_sort_threads, sort_segment, &ps, ps.parts);
+
+    /* Sort the samples by insertion, then take evenly spaced splitters */
+    int nsample = ps.parts * SORT_OVERSAMPLE;
+    for (int i = 1; i < nsample; i++) {
+        struct list_head *x = ps.sample[i];
+        int j = i;
+        for (; j > 0 && q_cmp(ps.sample[j - 1], x, descend) > 0; j--)
+            ps.sample[j] = ps.sample[j - 1];
+        ps.sample[j] = x;
+    }
+    for (int b = 0; b < ps.parts - 1; b++)
+        ps.splitter[b] = ps.sample[(b + 1) * SORT_OVERSAMPLE];
+
+    pool_run(q_sort_threads, cut_segment, &ps, ps.parts);
+    pool_run(q_sort_threads, merge_bucket, &ps, ps.parts);
+
+    struct list_head *tail = head;
+    for (int b = 0; b < ps.parts; b++) {
+        if (!ps.bucket[b].head)
+            continue;
+        tail->next = ps.bucket[b].head;
+        ps.bucket[b].head->prev = tail;
+        tail = ps.bucket[b].tail;
+    }
+    tail->next = head;
+    head->prev = tail;
+}
+
+/* Array sort
+ *
+ * Every node is gathered into an array together with the leading bytes of its
+ * string, which decide most comparisons without touching the element. The
+ * array is sorted by a stable bottom-up merge sort, starting from short
+ * blocks sorted by insertion, which streams through memory instead of chasing
+ * pointers. The second half of the buffer serves as the merge target. A
+ * final sequential pass relinks the list in sorted order.
+ */
+#define ARRAY_SORT_BLOCK 16
+
+static q_sort_slot_t *sort_buffer = NULL;
+static size_t sort_buffer_len = 0;
+
+void q_set_sort_buffer(q_sort_slot_t *buf, size_t n)
+{
+    sort_buffer = buf;
+    sort_buffer_len = buf ? n : 0;
+}
+
+static inline int slot_cmp(const q_sort_slot_t *a,
+                           const q_sort_slot_t *b,
+                           bool descend)
+{
+    int r;
+    if (a->key != b->key)
+        r = a->key < b->key ? -1 : 1;
+    else if (!(a->key & 0xff)) /* Both strings ended within the prefix */
+        r = 0;
+    else
+        r = strcmp(list_entry(a->node, element_t, list)->value + 8,
+                   list_entry(b->node, element_t, list)->value + 8);
+    return descend ? -r : r;
+}
+
+static void sort_array(struct list_head *head, size_t len, bool descend)
+{
+    q_sort_slot_t *a = sort_buffer, *tmp = sort_buffer + len;
+
+    size_t n = 0;
+    struct list_head *node;
+    list_for_each (node, head) {
+#ifdef Q_PREFIX_KEY
+        a[n].key = list_entry(node, element_t, list)->key;
+#else
+        a[n].key = q_prefix_key(list_entry(node, element_t, list)->value);
+#endif
+        a[n++].node = node;
+    }
+
+    for (size_t lo = 0; lo < len; lo += ARRAY_SORT_BLOCK) {
+        size_t hi = lo + ARRAY_SORT_BLOCK < len ? lo + ARRAY_SORT_BLOCK : len;
+        for (size_t i = lo + 1; i < hi; i++) {
+            q_sort_slot_t x = a[i];
+            size_t j = i;
+            for (; j > lo && slot_cmp(&x, &a[j - 1], descend) < 0; j--)
+                a[j] = a[j - 1];
+            a[j] = x;
+        }
+    }
+
+    for (size_t width = ARRAY_SORT_BLOCK; width < len; width *= 2) {
+        for (size_t lo = 0; lo < len; lo += 2 * width) {
+            size_t mid = lo + width < len ? lo + width : len;
+            size_t hi = mid + width < len ? mid + width : len;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                if (slot_cmp(&a[j], &a[i], descend) < 0)
+                    tmp[k++] = a[j++];
+                else
+                    tmp[k++] = a[i++];
+            }
+            while (i < mid)
+                tmp[k++] = a[i++];
+            while (j < hi)
+                tmp[k++] = a[j++];
+        }
+        q_sort_slot_t *t = a;
+        a = tmp;
+        tmp = t;
+    }
+
+    struct list_head *prev = head;
+    for (size_t i = 0; i < len; i++) {
+        prev->next = a[i].node;
+        a[i].node->prev = prev;
+        prev = a[i].node;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
+
+int q_sort_radix = 0;
+
+/* MSD radix sort
+ *
+ * Strings are distributed into 256 buckets by their byte at some depth, every
+ * bucket is sorted the same way one byte deeper, and the buckets are joined
+ * in byte order, reversed when sorting in descending order. Since the nodes
+ * are already linked, a bucket is simply a list that nodes are appended to,
+ * so no counting pass or permutation as in American flag sort is needed, and
+ * appending keeps the sort stable. Bucket 0 holds the strings ending at that
+ * depth, which are all equal and stay as they are.
+ *
+ * When all strings of a bucket share a longer prefix, which is found during
+ * the same pass, it is skipped at once rather than byte by byte.
+ *
+ * Buckets waiting to be sorted are kept on a stack, the one to come first in
+ * the output on top. Buckets of at most RADIX_SMALL nodes are finished by
+ * insertion sort. Should the stack run short, which takes strings sharing
+ * long prefixes with many different bytes below them, the bucket is handed
+ * to the merge sort instead.
+ */
+#define RADIX_SMALL 16
+#define RADIX_STACK 1024
+#define RADIX_SORTED SIZE_MAX
+
+struct radix_bucket {
+    struct list_head *head, *tail; /* NULL-terminated through next */
+    size_t len;
+    size_t depth; /* Leading bytes shared by all strings, or RADIX_SORTED */
+};
+
+static inline const char *node_str(const struct list_head *node)
+{
+    return list_entry(node, element_t, list)->value;
+}
+
+/* Stable insertion sort of a bucket whose strings share @b->depth bytes */
+static void radix_insertion(struct radix_bucket *b, bool descend)
+{
+    struct list_head *list = b->head, *sorted = NULL, *last = NULL;
+    while (list) {
+        struct list_head *node = list;
+        const char *s = node_str(node) + b->depth;
+        list = list->next;
+
+        struct list_head **pos = &sorted;
+        if (last) {
+            int r = strcmp(node_str(last) + b->depth, s);
+            if ((descend ? -r : r) <= 0) {
+                pos = &last->next;
+            } else {
+                for (;; pos = &(*pos)->next) {
+                    r = strcmp(node_str(*pos) + b->depth, s);
+                    if ((descend ? -r : r) > 0)
+                        break;
+                }
+            }
+        }
+        node->next = *pos;
+        *pos = node;
+        if (!node->next)
+            last = node;
+    }
+    b->head = sorted;
+    b->tail = last;
+}
+
+/* Sort a bucket with the merge sort, which relies on no depth */
+static void radix_fallback(struct radix_bucket *b, bool descend)
+{
+    struct list_head head = {.next = b->head, .prev = b->tail};
+    b->head->prev = &head;
+    b->tail->next = &head;
+    sort_list(&head, descend);
+    b->head = head.next;
+    b->tail = head.prev;
+    b->tail->next = NULL;
+}
+
+static void sort_radix(struct list_head *head, bool descend)
+{
+    struct radix_bucket stack[RADIX_STACK];
+    struct list_head *bucket_head[256] = {NULL}, *bucket_tail[256];
+    size_t bucket_len[256];
+    int top = 0;
+
+    struct radix_bucket all = {.head = head->next, .tail = head->prev};
+    struct list_head *node;
+    list_for_each (node, head)
+        all.len++;
+    stack[top++] = all;
+    head->prev->next = NULL;
+
+    struct list_head *tail = head;
+    while (top) {
+        struct radix_bucket b = stack[--top];
+        if (b.depth == RADIX_SORTED || b.len == 1) {
+            /* Nothing to do */
+        } else if (b.len <= RADIX_SMALL) {
+            radix_insertion(&b, descend);
+        } else if (top > RADIX_STACK - 256) {
+            radix_fallback(&b, descend);
+        } else {
+            /* Also find the prefix shared beyond this byte, if any */
+            const char *first = node_str(b.head) + b.depth;
+            size_t shared = strlen(first);
+            int lo = 255, hi = 0;
+            for (node = b.head; node; node = node->next) {
+                const char *str = node_str(node) + b.depth;
+                size_t k = 0;
+                while (k < shared && str[k] == first[k])
+                    k++;
+                shared = k;
+
+                unsigned char c = *str;
+                if (!bucket_head[c]) {
+                    bucket_head[c] = node;
+                    bucket_len[c] = 0;
+                    lo = c < lo ? c : lo;
+                    hi = c > hi ? c : hi;
+                } else {
+                    bucket_tail[c]->next = node;
+                }
+                bucket_tail[c] = node;
+                bucket_len[c]++;
+            }
+
+            /* All strings share more than one byte: skip straight past them */
+            if (shared > 1) {
+                bucket_tail[lo]->next = NULL;
+                b.depth += shared;
+                stack[top++] = b;
+                bucket_head[lo] = NULL;
+                continue;
+            }
+
+            /* Push the buckets so that they are popped in output order */
+            for (int i = lo; i <= hi; i++) {
+                int c = descend ? i : hi + lo - i;
+                if (!bucket_head[c])
+                    continue;
+                bucket_tail[c]->next = NULL;
+                stack[top++] = (struct radix_bucket){
+                    .head = bucket_head[c],
+                    .tail = bucket_tail[c],
+                    .len = bucket_len[c],
+                    .depth = c ? b.depth + 1 : RADIX_SORTED,
+                };
+                bucket_head[c] = NULL;
+            }
+            continue;
+        }
+
+        tail->next = b.head;
+        tail = b.tail;
+    }
+    tail->next = head;
+
+    /* Restore the prev links in a single pass */
+    struct list_head *prev = head;
+    list_for_each (node, head) {
+        node->prev = prev;
+        prev = node;
+    }
+    head->prev = prev;
 }
 
 /* Sort elements of queue in ascending/descending order */
-void q_sort(struct list_head *head, bool descend) {}
+void q_sort(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
+
+    if (q_sort_radix) {
+        sort_radix(head, descend);
+        return;
+    }
+
+    if (sort_buffer || q_sort_threads > 1) {
+        size_t len = 0;
+        struct list_head *node;
+        list_for_each (node, head)
+            len++;
+        if (len <= sort_buffer_len / 2) {
+            sort_array(head, len, descend);
+            return;
+        }
+        if (q_sort_threads > 1 && len >= PARALLEL_SORT_MIN) {
+            sort_parallel(head, len, descend);
+            return;
+        }
+    }
+    sort_list(head, descend);
+}
+
+/* Remove every node on the right-hand side of which exists a node that
+ * must be placed in front of it according to @descend.
+ */
+static int q_monotonic(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head))
+        return 0;
+
+    int len = 1;
+    struct list_head *bound = head->prev, *node = bound->prev;
+    while (node != head) {
+        struct list_head *prev = node->prev;
+        if (q_cmp(node, bound, descend) > 0) {
+            list_del(node);
+            q_release_element(list_entry(node, element_t, list));
+        } else {
+            bound = node;
+            len++;
+        }
+        node = prev;
+    }
+    return len;
+}
 
 /* Remove every node which has a node with a strictly less value anywhere to
  * the right side of it */
 int q_ascend(struct list_head *head)
 {
     // https://leetcode.com/problems/remove-nodes-from-linked-list/
-    return 0;
+    return q_monotonic(head, false);
 }
 
 /* Remove every node which has a node with a strictly greater value anywhere to
@@ -88,7 +1114,117 @@ int q_ascend(struct list_head *head)
 int q_descend(struct list_head *head)
 {
     // https://leetcode.com/problems/remove-nodes-from-linked-list/
-    return 0;
+    return q_monotonic(head, true);
+}
+
+/* Merge two sorted queues, moving every node of @from into @to.
+ *
+ * Queues whose ranges do not overlap are spliced in constant time. Otherwise
+ * the galloping merge keeps the number of comparisons close to the size of
+ * the smaller queue plus 1 / GALLOP_SPAN of the larger, and the part of @to
+ * behind the last node of @from is never visited.
+ */
+static void merge_lists(struct list_head *to,
+                        struct list_head *from,
+                        struct merge_state *ms)
+{
+    if (list_empty(from))
+        return;
+    if (list_empty(to) || q_cmp(to->prev, from->next, ms->descend) <= 0) {
+        list_splice_tail_init(from, to);
+        return;
+    }
+    if (q_cmp(from->prev, to->next, ms->descend) < 0) {
+        list_splice_init(from, to);
+        return;
+    }
+
+    struct run a = {.head = to->next, .tail = to->prev};
+    struct run b = {.head = from->next, .tail = from->prev};
+    a.tail->next = NULL;
+    b.tail->next = NULL;
+    merge_runs(&a, &b, ms);
+    INIT_LIST_HEAD(from);
+    link_run(to, &a);
+}
+
+/* Merge the queues of @ways[1..k-1] into that of @ways[0] */
+static void merge_ways(queue_contex_t **ways, int k, bool descend)
+{
+    if (k < 2)
+        return;
+    if (k == 2) {
+        struct merge_state ms = {.descend = descend, .min_gallop = MIN_GALLOP};
+        merge_lists(ways[0]->q, ways[1]->q, &ms);
+        return;
+    }
+
+    struct loser_tree lt = {.descend = descend, .k = k};
+    for (int i = 0; i < k; i++) {
+        struct list_head *q = ways[i]->q;
+        lt.cur[i] = list_empty(q) ? NULL : q->next;
+        lt.last[i] = q->prev;
+        q->prev->next = NULL;
+        INIT_LIST_HEAD(q);
+    }
+
+    struct list_head *head = ways[0]->q;
+    struct list_head *tail = lt_merge(&lt, head);
+    tail->next = head;
+    head->prev = tail;
+}
+
+int q_merge_threads = 1;
+
+/* Pairs of queues merged within one round of the tournament, at most
+ * MERGE_BATCH at a time since q_merge() may not allocate.
+ */
+#define MERGE_BATCH 64
+
+struct merge_batch {
+    bool descend;
+    queue_contex_t *to[MERGE_BATCH], *from[MERGE_BATCH];
+};
+
+static void merge_pair(void *arg, size_t i)
+{
+    struct merge_batch *batch = arg;
+    struct merge_state ms = {.descend = batch->descend,
+                             .min_gallop = MIN_GALLOP};
+    merge_lists(batch->to[i]->q, batch->from[i]->q, &ms);
+}
+
+/* Merge the queues pairwise in rounds. In the round with stride s, counting
+ * only contexts that have a queue, the one at each multiple of 2s absorbs the
+ * one s places after it, so the first ends up with everything. Every merge is
+ * stable and keeps the earlier queue in front, which makes the outcome equal
+ * to merging the queues into the first one by one.
+ */
+static void merge_tournament(struct list_head *head, bool descend)
+{
+    struct merge_batch batch = {.descend = descend};
+    for (size_t stride = 1;; stride <<= 1) {
+        size_t i = 0, n = 0;
+        queue_contex_t *ctx, *to = NULL;
+        list_for_each_entry (ctx, head, chain) {
+            if (!ctx->q)
+                continue;
+            if (i % (2 * stride) == 0) {
+                to = ctx;
+            } else if (i % (2 * stride) == stride) {
+                batch.to[n] = to;
+                batch.from[n++] = ctx;
+                if (n == MERGE_BATCH) {
+                    pool_run(q_merge_threads, merge_pair, &batch, n);
+                    n = 0;
+                }
+            }
+            i++;
+        }
+        pool_run(q_merge_threads, merge_pair, &batch, n);
+        if (i <= 2 * stride)
+            break;
+    }
 }
 
 /* Merge all the queues into one sorted queue, which is in ascending/descending
@@ -96,5 +1232,38 @@ int q_descend(struct list_head *head)
 int q_merge(struct list_head *head, bool descend)
 {
     // https://leetcode.com/problems/merge-k-sorted-lists/
-    return 0;
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_contex_t *first = list_first_entry(head, queue_contex_t, chain);
+    if (q_merge_threads > 1 && first->q) {
+        merge_tournament(head, descend);
+        return q_size(first->q);
+    }
+
+    /* With more than MERGE_WAYS queues, merge them in groups, then merge the
+     * results in groups again, and so on.
+     */
+    for (size_t stride = 1;; stride *= MERGE_WAYS) {
+        queue_contex_t *ways[MERGE_WAYS], *ctx;
+        size_t i = 0;
+        int k = 0;
+        list_for_each_entry (ctx, head, chain) {
+            if (!ctx->q || i++ % stride)
+                continue;
+            ways[k++] = ctx;
+            if (k == MERGE_WAYS) {
+                merge_ways(ways, k, descend);
+                k = 0;
+            }
+        }
+        merge_ways(ways, k, descend);
+        if (i <= stride * MERGE_WAYS)
+            break;
+    }
+
+    /* The size fields of the contexts belong to the caller, so count the
+     * nodes that actually ended up in the first queue.
+     */
+    return q_size(first->q);
 }
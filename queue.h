@@ -9,6 +9,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "harness.h"
 #include "list.h"
@@ -17,12 +19,21 @@
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
+ * @key: first bytes of @value packed by q_prefix_key(), only present when
+ *       built with Q_PREFIX_KEY
+ * @data: storage for the string when it lives in the same block
  *
- * @value needs to be explicitly allocated and freed
+ * @value either points to @data, so that the element and its string are
+ * allocated and freed as a single block, or to a string which needs to be
+ * explicitly allocated and freed on its own.
  */
 typedef struct {
     char *value;
     struct list_head list;
+#ifdef Q_PREFIX_KEY
+    uint64_t key;
+#endif
+    char data[];
 } element_t;
 
 /**
@@ -61,6 +72,7 @@ void q_free(struct list_head *head);
  *
  * Argument s points to the string to be stored.
  * The function must explicitly allocate space and copy the string into it.
+ * The string may be embedded in the element itself, see element_t.
  *
  * Return: true for success, false for allocation failed or queue is NULL
  */
@@ -78,6 +90,34 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_head_bulk() - Insert several elements in the head
+ * @head: header of queue
+ * @s: array of strings would be inserted
+ * @n: number of strings in @s
+ *
+ * Same as calling q_insert_head() for s[0], s[1], ..., s[n - 1] in turn, so
+ * s[n - 1] ends up first. All elements are allocated before any of them is
+ * linked in; if one allocation fails, the queue is left untouched.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_bulk(struct list_head *head, char **s, size_t n);
+
+/**
+ * q_insert_tail_bulk() - Insert several elements at the tail
+ * @head: header of queue
+ * @s: array of strings would be inserted
+ * @n: number of strings in @s
+ *
+ * Same as calling q_insert_tail() for s[0], s[1], ..., s[n - 1] in turn. All
+ * elements are allocated before any of them is linked in; if one allocation
+ * fails, the queue is left untouched.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_bulk(struct list_head *head, char **s, size_t n);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -116,10 +156,56 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
+    if (e->value != e->data)
+        test_free(e->value);
     test_free(e);
 }
 
+/**
+ * q_prefix_key() - Pack the leading bytes of a string into an integer
+ * @s: string to be packed
+ *
+ * Up to 8 bytes are stored in big-endian order and padded with zeros, so that
+ * comparing two keys as unsigned integers orders them the same way strcmp()
+ * orders their strings, as far as the first 8 bytes are concerned.
+ *
+ * Return: the packed prefix of @s
+ */
+static inline uint64_t q_prefix_key(const char *s)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        key <<= 8;
+        if (*s)
+            key |= (unsigned char) *s++;
+    }
+    return key;
+}
+
+/**
+ * q_element_cmp() - Compare the strings held by two elements
+ * @a: first element
+ * @b: second element
+ *
+ * When built with Q_PREFIX_KEY, the cached keys are compared first and the
+ * strings are only dereferenced if both share the same 8-byte prefix.
+ *
+ * Return: an integer less than, equal to, or greater than zero like strcmp()
+ */
+static inline int q_element_cmp(const element_t *a, const element_t *b)
+{
+#ifdef Q_PREFIX_KEY
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    /* Both strings ended within the prefix */
+    if (!(a->key & 0xff))
+        return 0;
+    return strcmp(a->value + 8, b->value + 8);
+#else
+    return strcmp(a->value, b->value);
+#endif
+}
+
 /**
  * q_size() - Get the size of the queue
  * @head: header of queue
@@ -200,6 +286,49 @@ void q_reverseK(struct list_head *head, int k);
  */
 void q_sort(struct list_head *head, bool descend);
 
+/*
+ * Number of threads q_sort() may use. With more than one, long queues are cut
+ * into segments which are sorted and then merged concurrently. The sort
+ * remains stable.
+ */
+extern int q_sort_threads;
+
+/*
+ * Whether q_sort() uses an MSD radix sort on the bytes of the strings instead
+ * of comparing them. The sort remains stable. This takes precedence over
+ * q_sort_threads and q_set_sort_buffer().
+ */
+extern int q_sort_radix;
+
+/*
+ * Whether the merges of q_sort() switch to galloping once one run keeps
+ * winning, which saves comparisons when the input is made of long blocks.
+ * Set by default. q_merge() always gallops.
+ */
+extern int q_sort_gallop;
+
+/**
+ * q_sort_slot_t - An entry of the scratch array used by q_sort()
+ * @key: leading bytes of the string, packed by q_prefix_key()
+ * @node: the list node of the element
+ */
+typedef struct {
+    uint64_t key;
+    struct list_head *node;
+} q_sort_slot_t;
+
+/**
+ * q_set_sort_buffer() - Lend scratch space to q_sort()
+ * @buf: array of slots owned by the caller, or NULL to take it back
+ * @n: number of slots in @buf
+ *
+ * As long as @buf holds at least two slots per element of the queue, q_sort()
+ * copies the nodes and the prefixes of their strings into it, sorts the array
+ * and relinks the queue in a single pass, instead of sorting the list itself.
+ * The buffer must stay valid until it is taken back.
+ */
+void q_set_sort_buffer(q_sort_slot_t *buf, size_t n);
+
 /**
  * q_ascend() - Remove every node which has a node with a strictly less
  * value anywhere to the right side of it.
@@ -252,4 +381,11 @@ int q_descend(struct list_head *head);
  */
 int q_merge(struct list_head *head, bool descend);
 
+/*
+ * Number of threads q_merge() may use. With more than one, disjoint pairs of
+ * queues are merged concurrently, in about log2(k) rounds for k queues. The
+ * result is the same as that of merging them one after another.
+ */
+extern int q_merge_threads;
+
 #endif /* LAB0_QUEUE_H */
@@ -28,6 +28,8 @@
 #define _GNU_SOURCE
 #endif
 
+#include <string.h>
+
 #include "random.h"
 
 #if defined(__linux__) || defined(__GNU__)
@@ -264,7 +266,7 @@ static int bsd_randombytes(void *buf, size_t n)
     /* We prefer CCRandomGenerateBytes as it returns an error code while
      * arc4random_buf may fail silently on macOS.
      */
-    return (CCRandomGenerateBytes(buf, n) == kCCSuccess);
+    return CCRandomGenerateBytes(buf, n) == kCCSuccess ? 0 : -1;
 #else
     arc4random_buf(buf, n);
     return 0;
@@ -272,7 +274,8 @@ static int bsd_randombytes(void *buf, size_t n)
 }
 #endif
 
-int randombytes(uint8_t *buf, size_t n)
+/* Fill @buf straight from the random source of the OS */
+static int randombytes_os(uint8_t *buf, size_t n)
 {
 #if defined(__linux__) || defined(__GNU__)
 #if defined(USE_GLIBC)
@@ -291,3 +294,50 @@ int randombytes(uint8_t *buf, size_t n)
 #error "randombytes(...) is not supported on this platform"
 #endif
 }
+
+/* Entropy pool
+ *
+ * Requests smaller than the pool are served from a buffer refilled in bulk,
+ * so that most of them cost a copy instead of a system call. Every byte is
+ * handed out once only. Each thread has its own pool, so no lock is needed.
+ */
+#define ENTROPY_POOL_SIZE 4096
+
+static _Thread_local uint8_t entropy_pool[ENTROPY_POOL_SIZE];
+static _Thread_local size_t entropy_left = 0; /* Unused bytes at the end */
+
+int randombytes(uint8_t *buf, size_t n)
+{
+    if (n >= ENTROPY_POOL_SIZE)
+        return randombytes_os(buf, n);
+
+    while (n > 0) {
+        if (!entropy_left) {
+            int ret = randombytes_os(entropy_pool, ENTROPY_POOL_SIZE);
+            if (ret)
+                return ret;
+            entropy_left = ENTROPY_POOL_SIZE;
+        }
+        size_t chunk = n <= entropy_left ? n : entropy_left;
+        memcpy(buf, entropy_pool + ENTROPY_POOL_SIZE - entropy_left, chunk);
+        entropy_left -= chunk;
+        buf += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+uint8_t randombit(void)
+{
+    static _Thread_local uint64_t bits;
+    static _Thread_local int nbits = 0;
+
+    if (!nbits) {
+        randombytes((uint8_t *) &bits, sizeof(bits));
+        nbits = 64;
+    }
+    uint8_t ret = bits & 1;
+    bits >>= 1;
+    nbits--;
+    return ret;
+}
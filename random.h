@@ -4,14 +4,13 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Fill @buf with @len random bytes from the OS, buffered through a pool
+ * refilled in bulk. Return 0 on success.
+ */
 extern int randombytes(uint8_t *buf, size_t len);
 
-static inline uint8_t randombit(void)
-{
-    uint8_t ret = 0;
-    randombytes(&ret, 1);
-    return ret & 1;
-}
+/* Return a random bit, taken from a cached random word */
+extern uint8_t randombit(void);
 
 #if INTPTR_MAX == INT64_MAX
 #define M_INTPTR_SHIFT (3)
@@ -23,6 +22,25 @@ static inline uint8_t randombit(void)
 
 #define M_INTPTR_SIZE (1 << M_INTPTR_SHIFT)
 
+/* splitmix64 by Sebastiano Vigna, see:
+ * <http://xoshiro.di.unimi.it/splitmix64.c>
+ * Its state is a Weyl sequence stepping by SPLITMIX64_GAMMA, which
+ * splitmix64_mix() turns into output.
+ */
+#define SPLITMIX64_GAMMA 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t splitmix64_mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t splitmix64_next(uint64_t *state)
+{
+    return splitmix64_mix(*state += SPLITMIX64_GAMMA);
+}
+
 static inline uintptr_t random_shuffle(uintptr_t x)
 {
     /* Ensure we do not get stuck in generating zeros */
@@ -30,12 +48,7 @@ static inline uintptr_t random_shuffle(uintptr_t x)
         x = 17;
 
 #if M_INTPTR_SIZE == 8
-    /* by Sebastiano Vigna, see: <http://xoshiro.di.unimi.it/splitmix64.c> */
-    x ^= x >> 30;
-    x *= 0xbf58476d1ce4e5b9UL;
-    x ^= x >> 27;
-    x *= 0x94d049bb133111ebUL;
-    x ^= x >> 31;
+    x = splitmix64_mix(x);
 #elif M_INTPTR_SIZE == 4
     /* by Chris Wellons, see: <https://nullprogram.com/blog/2018/07/31/> */
     x ^= x >> 16;
@@ -48,4 +61,40 @@ static inline uintptr_t random_shuffle(uintptr_t x)
     return x;
 }
 
+/* xoshiro256** by David Blackman and Sebastiano Vigna, see:
+ * <https://prng.di.unimi.it/xoshiro256starstar.c>
+ * Fast and statistically sound, but not cryptographically secure.
+ */
+typedef struct {
+    uint64_t s[4];
+} xoshiro256_t;
+
+static inline uint64_t xoshiro_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* Expand @seed into a full state with splitmix64, as the authors recommend */
+static inline void xoshiro256_seed(xoshiro256_t *x, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+        x->s[i] = splitmix64_next(&seed);
+}
+
+static inline uint64_t xoshiro256_next(xoshiro256_t *x)
+{
+    uint64_t *s = x->s;
+    uint64_t result = xoshiro_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = xoshiro_rotl(s[3], 45);
+
+    return result;
+}
+
 #endif
@@ -1,31 +1,128 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /* Precalculated log2 realization */
 #include "log2_lshift16.h"
 
 /* Shannon full integer entropy calculation */
 #define BUCKET_SIZE (1 << 8)
 
+/* Bytes are spread over this many histograms, so that runs of equal bytes do
+ * not serialize on a single counter through store-to-load forwarding.
+ */
+#define HIST_WAYS 4
+
+/* The string is scanned in aligned blocks of this size */
+#define BLOCK_SIZE 16
+
+/* Blocks counted into the first histogram before the others are cleared, so
+ * that short strings never pay for clearing them.
+ */
+#define NARROW_BLOCKS 16
+
+/* Reading a whole aligned block may touch bytes past the terminating NUL.
+ * Such a read cannot cross a page boundary and so cannot fault, but
+ * AddressSanitizer rightly reports it; scan byte by byte in that case.
+ */
+#if defined(__SANITIZE_ADDRESS__)
+#define SCAN_BYTEWISE
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define SCAN_BYTEWISE
+#endif
+#endif
+
+#ifndef SCAN_BYTEWISE
+/* Whether any of the BLOCK_SIZE bytes at the aligned address @p is NUL */
+static inline bool block_has_nul(const uint8_t *p)
+{
+#if defined(__SSE2__)
+    __m128i v = _mm_load_si128((const __m128i *) p);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+#else
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t v[2];
+    memcpy(v, p, sizeof(v));
+    return ((v[0] - ones) & ~v[0] & highs) | ((v[1] - ones) & ~v[1] & highs);
+#endif
+}
+#endif
+
 double shannon_entropy(const uint8_t *s)
 {
     assert(s);
-    const uint64_t count = strlen((char *) s);
     uint64_t entropy_sum = 0;
     const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
 
-    uint32_t bucket[256];
-    memset(&bucket, 0, sizeof(bucket));
+    uint32_t bucket[HIST_WAYS][BUCKET_SIZE];
+    memset(bucket[0], 0, sizeof(bucket[0]));
+    bool wide = false;
 
-    for (uint32_t i = 0; i < count; i++)
-        bucket[s[i]]++;
+    const uint8_t *p = s;
+#ifndef SCAN_BYTEWISE
+    while ((uintptr_t) p & (BLOCK_SIZE - 1)) {
+        if (!*p)
+            goto counted;
+        bucket[0][*p++]++;
+    }
 
-    for (uint32_t i = 0; i < BUCKET_SIZE; i++) {
-        if (bucket[i]) {
-            uint64_t p = bucket[i];
-            p *= LOG2_ARG_SHIFT / count;
-            entropy_sum += -p * log2_lshift16(p);
+    for (int narrow = 0; !block_has_nul(p); p += BLOCK_SIZE) {
+        if (narrow < NARROW_BLOCKS) {
+            for (int i = 0; i < BLOCK_SIZE; i++)
+                bucket[0][p[i]]++;
+            narrow++;
+            continue;
+        }
+        if (!wide) {
+            memset(bucket[1], 0, sizeof(bucket) - sizeof(bucket[0]));
+            wide = true;
+        }
+        for (int i = 0; i < BLOCK_SIZE; i += HIST_WAYS) {
+            bucket[0][p[i]]++;
+            bucket[1][p[i + 1]]++;
+            bucket[2][p[i + 2]]++;
+            bucket[3][p[i + 3]]++;
+        }
+    }
+#endif
+    while (*p)
+        bucket[0][*p++]++;
+
+#ifndef SCAN_BYTEWISE
+counted:;
+#endif
+    const uint64_t count = p - s;
+    if (wide) {
+        for (uint32_t i = 0; i < BUCKET_SIZE; i++)
+            bucket[0][i] += bucket[1][i] + bucket[2][i] + bucket[3][i];
+    }
+
+    if (count < BUCKET_SIZE) {
+        /* Fewer bytes than buckets: visit each distinct byte once through
+         * the string itself instead of walking every bucket.
+         */
+        for (const uint8_t *q = s; q < p; q++) {
+            uint64_t c = bucket[0][*q];
+            if (c) {
+                bucket[0][*q] = 0;
+                c *= LOG2_ARG_SHIFT / count;
+                entropy_sum += -c * log2_lshift16(c);
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < BUCKET_SIZE; i++) {
+            if (bucket[0][i]) {
+                uint64_t c = bucket[0][i];
+                c *= LOG2_ARG_SHIFT / count;
+                entropy_sum += -c * log2_lshift16(c);
+            }
         }
     }
 
@@ -0,0 +1,17 @@
+# Test bulk insertion: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', 'q_remove_tail', and 'q_size'
+option fail 0
+option malloc 0
+new
+ih dolphin 1000
+it gerbil 1000
+ih bear
+it meerkat
+size
+rh bear
+rh dolphin
+rt meerkat
+rt gerbil
+ih RAND 1000
+it RAND 1000
+size
+free
@@ -0,0 +1,35 @@
+# Test merging queues in parallel: 'q_new', 'q_insert_head', 'q_sort', 'q_merge', and 'q_size'
+option fail 0
+option malloc 0
+option merge_threads 4
+new
+ih RAND 10000
+sort
+new
+ih RAND 10000
+sort
+new
+ih RAND 10000
+sort
+new
+ih RAND 10000
+sort
+new
+ih RAND 10000
+sort
+merge
+size
+free
+option descend 1
+new
+ih RAND 10000
+sort
+new
+ih RAND 10000
+sort
+new
+ih RAND 10000
+sort
+merge
+size
+free
@@ -0,0 +1,56 @@
+# Test sorting long queues with each backend: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_sort', 'q_reverse', and 'q_free'
+option fail 0
+option malloc 0
+new
+ih RAND 100000
+it dolphin 10000
+sort
+reverse
+sort
+free
+option sort_threads 4
+new
+ih RAND 100000
+it dolphin 10000
+sort
+reverse
+sort
+option descend 1
+sort
+free
+option descend 0
+option sort_threads 1
+option sort_array 1
+new
+ih RAND 100000
+it dolphin 10000
+sort
+reverse
+sort
+option descend 1
+sort
+free
+option descend 0
+option sort_array 0
+option sort_radix 1
+new
+ih RAND 100000
+it dolphin 10000
+sort
+reverse
+sort
+option descend 1
+sort
+free
+option descend 0
+option sort_radix 0
+option sort_gallop 0
+new
+ih RAND 100000
+it dolphin 10000
+sort
+reverse
+sort
+option descend 1
+sort
+free
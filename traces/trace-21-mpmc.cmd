@@ -0,0 +1,14 @@
+# Test the concurrent queue from several threads in each mode: 'q_insert_tail' and 'q_remove_head'
+option cqueue_mode 0
+mpmc 4 4 50000
+mpmc 1 4 50000
+mpmc 4 1 50000
+option cqueue_mode 1
+mpmc 4 4 50000
+mpmc 1 4 50000
+mpmc 4 1 50000
+option cqueue_mode 2
+mpmc 4 4 50000
+mpmc 1 4 50000
+mpmc 4 1 50000
+stress 4 50000
@@ -0,0 +1,33 @@
+# Test the slab arena and the magazines: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', 'q_remove_tail', and 'q_free'
+option fail 0
+option malloc 0
+option arena 1
+new
+ih dolphin 10000
+it gerbil 10000
+ih RAND 10000
+rh
+rt gerbil
+free
+option arena 0
+option magazine 1
+new
+ih dolphin 10000
+it gerbil 10000
+ih RAND 10000
+rh
+rt gerbil
+free
+option arena 1
+new
+ih dolphin 10000
+it RAND 10000
+sort
+free
+option cautious 0
+new
+ih dolphin 10000
+it gerbil 10000
+rh dolphin
+rt gerbil
+free
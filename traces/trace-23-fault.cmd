@@ -0,0 +1,29 @@
+# Test scheduled allocation failures by what they imply, whatever the layout of elements: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', and 'q_remove_tail'
+option fail 10
+option malloc 0
+new
+option fail_nth 3
+ih alpaca 5
+option fail_nth 0
+it zebra
+rh alpaca
+rh alpaca
+rh alpaca
+rh alpaca
+rh zebra
+option fail_nth 1
+ih bear
+ih cheetah
+option fail_nth 0
+rt cheetah
+option fail_nth 1
+option fail_class -2
+ih gerbil
+ih badger
+option fail_nth 0
+option fail_class -1
+it zebra
+rh zebra
+ih gerbil
+rh gerbil
+free
@@ -0,0 +1,37 @@
+# Test that a seed repeats its RAND strings and malloc failures, which sorting and removing duplicates then cancel out: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_sort', 'q_delete_dup', and 'q_remove_head'
+option fail 50
+option malloc 0
+new
+option seed 1
+ih RAND 3
+option seed 1
+ih RAND 3
+sort
+dedup
+it zebra
+rh zebra
+option seed 7
+option malloc 50
+it alpaca
+it bear
+it cheetah
+it dolphin
+it elephant
+it gerbil
+it hyena
+it iguana
+option seed 7
+it alpaca
+it bear
+it cheetah
+it dolphin
+it elephant
+it gerbil
+it hyena
+it iguana
+option malloc 0
+sort
+dedup
+it zebra
+rh zebra
+free
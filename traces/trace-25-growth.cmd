@@ -0,0 +1,16 @@
+# Test fitting the growth of operations from their timings, which fails unless the class given is among the best fits: 'q_insert_tail' and 'q_remove_head' in O(1), 'q_size' in O(n) and 'q_sort' in O(n log n), and refusing commands which do not work on one queue alone
+option fail 0
+option malloc 0
+complexity O(1) it dolphin
+complexity O(1) rh
+complexity O(n) size
+complexity O(nlogn) sort
+complexity free
+complexity new
+complexity complexity size
+new
+ih gerbil
+complexity quit
+complexity next
+size
+free